@@ -9,7 +9,9 @@
  * I use segregated lists with LIFO policy to save free blocks, simple second
  * fit policy to find the fitable free block through comparing the first two
  * fitable free blocks, and choose the one with less left size. For segregated 
- * list, I have total nine lists, which increases by multiple 2. The least free
+ * list, I have total nine lists, which increases by multiple 2. The upper
+ * sizes of the lists come from mm_sizeclass.h, which mm_sctool can generate
+ * from allocation traces to replace this default table. The least free
  * block has 16 byte, 4 for header, 4 for next free block address (last 32 bit), 
  * 4 for previous free block address (last 32 bit), and 4 for footer. If the 
  * free block is the first element in the list, then its previous block address
@@ -24,18 +26,41 @@
  * For prev_alloc bit, it saves the status of physical previous block.
  * For cycle bit, it is used in check_list to check whether all free blocks
  * are in the segregated lists.  
+ * mm_malloc_usable_size reports the real payload size of an allocated
+ * block (block size minus header), and realloc returns the old block
+ * directly when the new size still fits in it.
+ * With deferred freeing turned on (MM_CONF defer:N, off by default),
+ * free only puts the block into a FIFO deferred free queue, the block
+ * keeps its allocated status until it is released (coalesced and put
+ * into the segregated list) by mm_maintain, by malloc (a few blocks
+ * at most) before extending the heap, or by free when the queue is full.
+ * The heap extension size, the deferred free queue length and the fit
+ * policy of each size class can be tuned at runtime through the MM_CONF
+ * environment variable, which is parsed once in mm_init.
+ * The large size classes also keep a side index of (size, address)
+ * pairs in contiguous arrays, which findfit scans instead of the list.
+ * mm_malloc_cacheline hands out cache line aligned and padded objects,
+ * small ones from dedicated runs with one free slot list per size.
+ * mm_persist saves the heap image and its roots (as offsets from the
+ * heap start) to a file, and mm_attach maps such a file back as the
+ * heap, so a restarted process keeps its heap without rebuilding it.
  */
 
 #include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "contracts.h"
 
 #include "mm.h"
 #include "memlib.h"
+#include "mm_ext.h"
 
 
 // Create aliases for driver tests
@@ -81,27 +106,74 @@
 #define MAX(x, y) ((x) > (y)? (x) : (y))
 /* the starting adress of the heap */
 #define PINIT (char *)0x800000000
+/* number of size classes */
+#define NCLASS MM_NCLASS
 /* define segregated list ptr, size class pointer */
 static char *heap_listp = NULL;
-static char *sc16p = NULL; 
-static char *sc32p = NULL; 
-static char *sc64p = NULL; 
-static char *sc128p = NULL; 
-static char *sc256p = NULL; 
-static char *sc512p = NULL; 
-static char *sc1024p = NULL; 
-static char *sc2048p = NULL; 
-static char *sc2049p = NULL; 
-/* the upper size of the segregated list */
+static char *sclist[NCLASS];
+/* side index of the large size classes: the size and the last 32 bit
+ * of the address of every free block in the list, kept in contiguous
+ * arrays so findfit scans them instead of chasing the list links. The
+ * block keeps its position in the arrays at bp + DSIZE. A class whose
+ * arrays are full is marked sxbad and searched by the list again until
+ * the list gets empty. After mm_attach a class with free blocks is
+ * marked sxstale, its index is left empty and built from the list the
+ * first time findfit searches it */
+#define SXMINSIZE 256
+#define SXMAX 2048
+#define SXNONE 0xffffffff
+/* positions scanned per step of the first fit scan */
+#define SXSTEP 8
+static unsigned int sxsize[NCLASS][SXMAX];
+static unsigned int sxoff[NCLASS][SXMAX];
+static unsigned int sxcnt[NCLASS];
+static int sxbad[NCLASS];
+static int sxstale[NCLASS];
+/* deferred free queue, blocks wait here until they are released */
+static char *deferhead = NULL;
+static char *defertail = NULL;
+static size_t defercnt = 0;
+/* the most blocks the deferred free queue holds, 0 turns it off */
+#define DEFERMAX 0
+/* the most deferred blocks malloc releases before extending the heap */
+#define DEFERMISS 4
+/* cache line size, and the most lines a slot of a dedicated run has */
+#define CACHELINE 64
+#define CLNCLASS 4
+/* bytes of slots in one dedicated run */
+#define CLRUNSIZE 4096
+/* free slots of the dedicated runs, one list per number of lines */
+static char *clfree[CLNCLASS];
+/* fit policy used by findfit in a size class */
+#define FIT_FIRST 0
+#define FIT_SECOND 1
+#define FIT_BEST 2
+/* magic and version of a persisted heap file */
+#define PERSISTMAGIC "mmheap\0\0"
+#define PERSISTVER 2
+/* header at the start of a persisted heap file, all the roots are
+ * saved as offsets from the heap start, 0 for NULL. The links inside
+ * the heap only keep the last 32 bit of the address, which are already
+ * offsets from PINIT, so the heap image needs no fixing up */
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int nclass;
+    size_t imageoff;            /* file offset of the heap image */
+    size_t heapsize;            /* bytes of the heap image */
+    size_t scupper[NCLASS];     /* size class table of the heap */
+    size_t listoff;             /* offset of heap_listp */
+    size_t scoff[NCLASS];       /* offsets of the segregated list heads */
+    size_t cloff[CLNCLASS];     /* offsets of the cache line slot lists */
+} persist_t;
+/* environment variable holding the runtime tunables */
+#define CONFENV "MM_CONF"
+/* runtime tunables, set from CONFENV in mm_init */
+static size_t chunksize = CHUNKSIZE;
+static size_t defermax = DEFERMAX;
+static int fitpol[NCLASS];
+/* the lower size of the first segregated list */
 #define SIZE0 0
-#define SIZE16 16
-#define SIZE32 32
-#define SIZE64 64
-#define SIZE128 128
-#define SIZE256 256
-#define SIZE512 512
-#define SIZE1024 1024
-#define SIZE2048 2048
 #define SIZEMAX  0xffffffffffffffff
 
 /*
@@ -273,33 +345,54 @@ static inline void CLEAR_CYCLE(char *p) {
 static void *extend_heap(size_t words);
 static void *coalesce(char *bp);
 static void place(char *bp, size_t asize);
-static char *find_fit(size_t asize);
+static char *find_fit(size_t asize, int cls);
+static char *find_exact(size_t asize, int cls);
+static void *malloc_block(size_t asize, int cls, int exact);
 static void delete(char *bp, size_t size);
 static void insert(char *bp, size_t size);
-static void checkblock(void *bp);
+static int checkblock(void *bp);
+static inline int is_block(char *bp);
 static void printblock(void *bp);
-static void checklist(void);
-static void check_list(char *scp, size_t lowsize, size_t upsize);
-static char *findfit(char *bp,char *sizep,size_t *sp,size_t los,size_t ups);
+static int checklist(void);
+static int check_list(char *scp, size_t lowsize, size_t upsize);
+static int sizeclass(size_t size);
+static size_t sclower(int cls);
+static int sxindexed(int cls);
+static void sx_insert(char *bp, size_t size, int cls);
+static void sx_delete(char *bp, int cls);
+static void sx_rebuild(int cls);
+static char *sxfindfit(int cls, size_t *sp, size_t ups, int fit);
+static int sx_scan(const unsigned int *sz, int from, unsigned int asize);
+static char *findfit(char *bp,char *sizep,size_t *sp,size_t los,size_t ups,
+                     int fit);
+static void parse_conf(const char *conf);
+static char *release(char *bp, size_t size);
+static char *defer_pop(void);
+static char *defer_release(void);
+static int write_all(int fd, const void *buf, size_t len);
+static int bad_root(size_t off, size_t heapsize);
 
 /*
  * Initialize: return -1 on error, 0 on success.
  */
 int mm_init(void) {
 
+    int i;
     /* reset the segregated list root ptr */ 
     heap_listp = NULL;
-    sc16p = NULL; 
-    sc32p = NULL; 
-    sc64p = NULL; 
-    sc128p = NULL; 
-    sc256p = NULL; 
-    sc512p = NULL; 
-    sc1024p = NULL; 
-    sc2048p = NULL; 
-    sc2049p = NULL; 
+    for (i = 0; i < NCLASS; i++){
+        sclist[i] = NULL;
+        sxcnt[i] = 0;
+        sxbad[i] = 0;
+        sxstale[i] = 0;
+    }
+    for (i = 0; i < CLNCLASS; i++)
+        clfree[i] = NULL;
+    deferhead = NULL;
+    defertail = NULL;
+    defercnt = 0;
+    parse_conf(getenv(CONFENV));
 
-    char *bp;
     /* create the initial empty heap */
     if ((heap_listp = mem_sbrk(4*WSIZE)) == (void *)(-1))
         return -1;
@@ -311,20 +404,101 @@ int mm_init(void) {
     PUT_PREV_ALLOC(heap_listp + 3*WSIZE); 
     heap_listp += (2*WSIZE);
 
-    /* extend the empty heap with a free block of CHUNKSIZE bytes */
-    if (extend_heap(CHUNKSIZE/WSIZE) == NULL)
+    /* extend the empty heap with a free block of chunksize bytes,
+     * extend_heap puts it into the coresponding list */
+    if (extend_heap(chunksize/WSIZE) == NULL)
         return -1;
-    /* initialize the segregated list, previous is root, set it as 0 */
-    bp = heap_listp + DSIZE;
-    PUT(bp, (unsigned long)NULL);
-    PUT((bp + WSIZE), 0);
-    /* allocate bp to coresponding list according to size */
-    sc256p = bp;    
     return 0;
 }
 
 /*
- * extend heap with CHUNKSIZE
+ * parse_conf - set the runtime tunables from a string like
+ * "chunk:4096,defer:64,fit:best,fit8:first", in which
+ *   chunk:N     bytes the heap is extended by at least (CHUNKSIZE)
+ *   defer:N     blocks the deferred free queue holds, 0 frees at once
+ *               (DEFERMAX)
+ *   fit:P       fit policy (first, second or best) of all size classes
+ *   fitK:P      fit policy of size class K only, counted from 0
+ * Unknown keys and bad values are ignored, a value must be all of the
+ * text up to the next comma. Every tunable goes back to
+ * its default first, so each mm_init only sees the current CONFENV
+ */
+static void parse_conf(const char *conf){
+
+    int i, k, fit;
+    size_t len, vlen;
+    unsigned long val;
+    const char *key, *v;
+    char *end;
+
+    chunksize = CHUNKSIZE;
+    defermax = DEFERMAX;
+    for (i = 0; i < NCLASS; i++)
+        fitpol[i] = FIT_SECOND;
+    if (conf == NULL)
+        return;
+
+    while (*conf != '\0'){
+        /* split "key:value" */
+        key = conf;
+        while ((*conf != '\0') && (*conf != ':') && (*conf != ','))
+            conf++;
+        len = conf - key;
+        if (*conf != ':'){
+            dbg_printf("%s: no value for %.*s\n", CONFENV, (int)len, key);
+            if (*conf == ',')
+                conf++;
+            continue;
+        }
+        v = ++conf;
+        while ((*conf != '\0') && (*conf != ','))
+            conf++;
+        vlen = conf - v;
+
+        /* numbers are only digits, strtoul would take a sign or spaces */
+        if ((len == 5) && !strncmp(key, "chunk", len)){
+            val = strtoul(v, &end, 10);
+            if ((vlen != 0) && (*v >= '0') && (*v <= '9') && (end == conf) &&
+                (val <= (1UL << 30)))
+                chunksize = MAX(2*DSIZE, ALIGN(val));
+        }
+        else if ((len == 5) && !strncmp(key, "defer", len)){
+            val = strtoul(v, &end, 10);
+            if ((vlen != 0) && (*v >= '0') && (*v <= '9') && (end == conf))
+                defermax = val;
+        }
+        else if ((len >= 3) && !strncmp(key, "fit", 3)){
+            if ((vlen == 5) && !strncmp(v, "first", vlen))
+                fit = FIT_FIRST;
+            else if ((vlen == 6) && !strncmp(v, "second", vlen))
+                fit = FIT_SECOND;
+            else if ((vlen == 4) && !strncmp(v, "best", vlen))
+                fit = FIT_BEST;
+            else
+                fit = -1;
+            k = (len > 3) ? (int)strtoul(key + 3, &end, 10) : -1;
+            if ((len > 3) && ((key[3] < '0') || (key[3] > '9') ||
+                              (end != key + len)))
+                k = -1;
+            if ((fit >= 0) && (len == 3)){
+                for (i = 0; i < NCLASS; i++)
+                    fitpol[i] = fit;
+            }
+            else if ((fit >= 0) && (k >= 0) && (k < NCLASS))
+                fitpol[k] = fit;
+        }
+        else{
+            dbg_printf("%s: unknown key %.*s\n", CONFENV, (int)len, key);
+        }
+
+        if (*conf == ',')
+            conf++;
+    }
+    return;
+}
+
+/*
+ * extend heap with words words
  */
 
 static void *extend_heap(size_t words){
@@ -356,10 +530,12 @@ static void *extend_heap(size_t words){
 /*
  * sub_function of find_fit, find a free block in a certain free list
  * sizep is the size class ptr, sp is the given size ptr, los is lowsize
- * ups is upsize, if find fitable free block ptr, return it, oterwise, 
- * return bp = NULL, and update size to let it go into next size class
+ * ups is upsize, fit is the fit policy of the list, if find fitable free
+ * block ptr, return it, oterwise, return bp = NULL, and update size to
+ * let it go into next size class
  */
-static char *findfit(char *bp,char *sizep,size_t *sp,size_t los,size_t ups){
+static char *findfit(char *bp,char *sizep,size_t *sp,size_t los,size_t ups,
+                     int fit){
 
     REQUIRES(sp != NULL);
 
@@ -389,13 +565,17 @@ static char *findfit(char *bp,char *sizep,size_t *sp,size_t los,size_t ups){
         *sp = ups + 1;
         return bp;
     }
+    if ((fit == FIT_FIRST) || (leftsize1 == 0))
+        return bp1;
    
-    /* second find fit */
+    /* second find fit, best fit keeps on until the end of the list */
     for (ptr=NEXT_BLKP(bp1);(ptr!=PINIT)&&(ptr!=NULL);ptr=NEXT_BLKP(ptr)){
-        if (GET_SIZE(HDRP(ptr)) >= *sp){
+        if ((GET_SIZE(HDRP(ptr)) >= *sp) &&
+            (GET_SIZE(HDRP(ptr)) - *sp < leftsize2)){
             leftsize2 = GET_SIZE(HDRP(ptr)) - *sp;
             bp2 = ptr;
-            break;     
+            if ((fit == FIT_SECOND) || (leftsize2 == 0))
+                break;     
         }
     }
     /* choose one with leftsize */
@@ -405,24 +585,126 @@ static char *findfit(char *bp,char *sizep,size_t *sp,size_t los,size_t ups){
 }
 
 /* 
- * find the fit size class and return fitable free block ptr
+ * find the fit size class and return fitable free block ptr,
+ * cls is the size class of asize
  */
-static char *find_fit(size_t asize){
+static char *find_fit(size_t asize, int cls){
 
     REQUIRES(asize != 0);
+    REQUIRES(cls == sizeclass(asize));
     asize = asize;
     size_t size = asize;
     char *bp = NULL;
-    bp = findfit(bp, sc16p, &size, SIZE0, SIZE16); 
-    bp = findfit(bp, sc32p, &size, SIZE16, SIZE32); 
-    bp = findfit(bp, sc64p, &size, SIZE32, SIZE64); 
-    bp = findfit(bp, sc128p, &size, SIZE64, SIZE128); 
-    bp = findfit(bp, sc256p, &size, SIZE128, SIZE256); 
-    bp = findfit(bp, sc512p, &size, SIZE256, SIZE512); 
-    bp = findfit(bp, sc1024p, &size, SIZE512, SIZE1024); 
-    bp = findfit(bp, sc2048p, &size, SIZE1024, SIZE2048);
-    bp = findfit(bp, sc2049p, &size, SIZE2048, SIZEMAX);
+    int i;
+    /* start from the size class of asize, go to larger ones if no fit,
+     * use the side index of the class when it holds every block */
+    for (i = cls; (i < NCLASS) && (bp == NULL); i++){
+        if (sxindexed(i) && sxstale[i])
+            sx_rebuild(i);
+        if (sxindexed(i) && !sxbad[i])
+            bp = sxfindfit(i, &size, mm_scupper[i], fitpol[i]);
+        else
+            bp = findfit(bp, sclist[i], &size, sclower(i), mm_scupper[i],
+                         fitpol[i]);
+    }
+
+    return bp;
+}
+
+/*
+ * find_exact - return a free block of exactly asize bytes, or NULL,
+ * only the list of its size class cls can hold one
+ */
+static char *find_exact(size_t asize, int cls){
+
+    REQUIRES(cls == sizeclass(asize));
+    char *bp;
+
+    for (bp = sclist[cls]; (bp != NULL) && (bp != PINIT);
+         bp = NEXT_BLKP(bp)){
+        if (GET_SIZE(HDRP(bp)) == asize)
+            return bp;
+    }
+    return NULL;
+}
+
+/*
+ * sx_scan - return the last position below from in the sizes sz whose
+ * size is at least asize, or -1. Positions are scanned downward, so the
+ * newest blocks come first like in the LIFO lists, and SXSTEP sizes are
+ * tested at a time without branching, so the compiler can vectorize it
+ */
+static inline int sx_scan(const unsigned int *sz, int from, unsigned int asize){
+
+    unsigned int hit;
+    int j = from, k;
+
+    for (; j >= SXSTEP; j -= SXSTEP){
+        hit = 0;
+        for (k = 1; k <= SXSTEP; k++)
+            hit |= (sz[j - k] >= asize);
+        if (hit)
+            break;
+    }
+    while ((--j >= 0) && (sz[j] < asize))
+        ;
+    return j;
+}
+
+/*
+ * sxfindfit - findfit over the side index of size class cls, with the
+ * same fit policies. Best fit takes the least left size of SXSTEP
+ * sizes at a time without branching, and stops at an exact fit. The header
+ * and the next header of the chosen block, which place writes, are
+ * prefetched.
+ */
+static char *sxfindfit(int cls, size_t *sp, size_t ups, int fit){
+
+    REQUIRES(sp != NULL);
+    REQUIRES(sxindexed(cls) && !sxbad[cls]);
+    const unsigned int *sz = sxsize[cls];
+    size_t asize = *sp, left, least, found;
+    int pos, pos2, j, k;
+    char *bp;
+
+    /* fisrt find fit, the index only holds 32 bit sizes, so a larger
+     * asize fits none, and the scan can compare in 32 bit */
+    if ((asize > UINT_MAX) || ((pos = sx_scan(sz, sxcnt[cls], asize)) < 0)){
+        *sp = ups + 1;
+        return NULL;
+    }
+
+    /* second find fit, choose the one with less left size */
+    if ((fit == FIT_SECOND) && (sz[pos] != asize)){
+        pos2 = sx_scan(sz, pos, asize);
+        if ((pos2 >= 0) && (sz[pos2] < sz[pos]))
+            pos = pos2;
+    }
+
+    /* best fit, the least left size of each SXSTEP sizes below pos,
+     * going down until an exact fit, then where it is in those sizes */
+    else if ((fit == FIT_BEST) && (sz[pos] != asize)){
+        least = sz[pos] - asize;
+        for (j = pos; (j > 0) && (least != 0); j -= SXSTEP){
+            found = least;
+            for (k = 1; k <= SXSTEP; k++){
+                left = ((j - k >= 0) && (sz[j - k] >= asize)) ?
+                       (sz[j - k] - asize) : SIZEMAX;
+                found = (left < found) ? left : found;
+            }
+            if (found < least){
+                least = found;
+                for (k = 1; (sz[j-k] < asize) || (sz[j-k] - asize != least);
+                     k++)
+                    ;
+                pos = j - k;
+            }
+        }
+    }
 
+    bp = (char *)((unsigned long)sxoff[cls][pos] | 0x800000000);
+    __builtin_prefetch(HDRP(bp), 1);
+    __builtin_prefetch(bp + sz[pos] - WSIZE, 1);
     return bp;
 }
 
@@ -474,6 +756,93 @@ static void place(char *bp, size_t asize){
     return; 
 }
 
+/*
+ * sizeclass - return the index of the segregated list for a free block
+ * of the given size, the last upper size is SIZEMAX so it always stops
+ */
+static int sizeclass(size_t size){
+    return mm_size_class(size);
+}
+
+/*
+ * sclower - the lower size of size class cls, the blocks of the class
+ * are larger than it. With a single class there is no mm_scupper[cls-1]
+ * to read at all, so it is left out of the build
+ */
+static inline size_t sclower(int cls){
+#if NCLASS > 1
+    if (cls > 0)
+        return mm_scupper[cls-1];
+#endif
+    cls = cls;
+    return SIZE0;
+}
+
+/*
+ * sxindexed - whether size class cls has a side index, the blocks of
+ * those classes are large enough to keep their position at bp + DSIZE
+ */
+static inline int sxindexed(int cls){
+    return (cls > 0) && (sclower(cls) >= SXMINSIZE);
+}
+
+/*
+ * sx_insert - add the free block to the side index of class cls
+ */
+static void sx_insert(char *bp, size_t size, int cls){
+
+    REQUIRES(sxindexed(cls));
+    unsigned int pos = sxcnt[cls];
+
+    if (sxstale[cls])
+        return;
+    if (pos == SXMAX){
+        sxbad[cls] = 1;
+        PUT(bp + DSIZE, SXNONE);
+        return;
+    }
+    sxsize[cls][pos] = size;
+    sxoff[cls][pos] = (unsigned long)bp;
+    sxcnt[cls]++;
+    PUT(bp + DSIZE, pos);
+}
+
+/*
+ * sx_delete - remove the free block from the side index of class cls,
+ * the last entry moves into its position
+ */
+static void sx_delete(char *bp, int cls){
+
+    REQUIRES(sxindexed(cls));
+    unsigned int pos, last;
+    char *moved;
+
+    if (sxstale[cls] || ((pos = GET(bp + DSIZE)) == SXNONE))
+        return;
+    last = --sxcnt[cls];
+    if (pos != last){
+        sxsize[cls][pos] = sxsize[cls][last];
+        sxoff[cls][pos] = sxoff[cls][last];
+        moved = (char *)((unsigned long)sxoff[cls][pos] | 0x800000000);
+        PUT(moved + DSIZE, pos);
+    }
+}
+
+/*
+ * sx_rebuild - build the side index of class cls again from its list
+ */
+static void sx_rebuild(int cls){
+
+    REQUIRES(sxindexed(cls));
+    char *p;
+
+    sxcnt[cls] = 0;
+    sxbad[cls] = 0;
+    sxstale[cls] = 0;
+    for (p = sclist[cls]; (p != NULL) && (p != PINIT); p = NEXT_BLKP(p))
+        sx_insert(p, GET_SIZE(HDRP(p)), cls);
+}
+
 /*
  * delete the free block from its size class segregated list
  */
@@ -484,32 +853,23 @@ static void delete(char *bp, size_t size){
     bp = bp;
     size = size;
     char **scp;
+    int cls = sizeclass(size);
     /* choose the rigjt size class ptr */
-    if (size <= 16)
-        scp = &sc16p;
-    else if (size <= 32)
-        scp = &sc32p;
-    else if (size <= 64)
-        scp = &sc64p;
-    else if (size <= 128)
-        scp = &sc128p;
-    else if (size <= 256)
-        scp = &sc256p;
-    else if (size <= 512)
-        scp = &sc512p;
-    else if (size <= 1024)
-        scp = &sc1024p;
-    else if (size <= 2048)
-        scp = &sc2048p;
-    else
-        scp = &sc2049p;
+    scp = &sclist[cls];
+    if (sxindexed(cls))
+        sx_delete(bp, cls);
 
     /* update the list */
     /* the first element in segregated list */
     if (GET(bp + WSIZE) == 0){
-        if (NEXT_BLKP(bp) == PINIT) 
-        /* next block ptr = NULL */
+        if (NEXT_BLKP(bp) == PINIT){
+        /* next block ptr = NULL, the side index starts over */
             *scp = NULL;
+            sxcnt[cls] = 0;
+            sxbad[cls] = 0;
+            sxstale[cls] = 0;
+            return;
+        }
         else{
         /* set the next block connects to the root */
             *scp = NEXT_BLKP(bp);
@@ -540,25 +900,10 @@ static void insert(char *bp, size_t size){
     bp = bp;
     size = size;
     char **scp;
-    if (size <= 16)
-        scp = &sc16p;
-    else if (size <= 32)
-        scp = &sc32p;
-    else if (size <= 64)
-        scp = &sc64p;
-    else if (size <= 128)
-        scp = &sc128p;
-    else if (size <= 256)
-        scp = &sc256p;
-    else if (size <= 512)
-        scp = &sc512p;
-    else if (size <= 1024)
-        scp = &sc1024p;
-    else if (size <= 2048)
-        scp = &sc2048p;
-    else
-        scp = &sc2049p;
-
+    int cls = sizeclass(size);
+    scp = &sclist[cls];
+    if (sxindexed(cls))
+        sx_insert(bp, size, cls);
 
     if (*scp == NULL){
        PUT((bp + WSIZE), 0);
@@ -581,29 +926,83 @@ void *malloc (size_t size) {
     checkheap(1);  // Let's make sure the heap is ok!
     size = size;
     size_t asize;      /* adjust size */
-    size_t extendsize; /* require to expend heap */
-    char *bp;
     
     /* initialize the heap */
     if (heap_listp == NULL)
         mm_init();
-    /* ignore sperious requests */
-    if (size == 0)
+    /* ignore sperious requests, and ones too large for the header */
+    if ((size == 0) || (size > UINT_MAX))
         return NULL;
     /* adjust block size to satisfy alignment */
-    if (size <= DSIZE)
-        asize = 2 * DSIZE;
-    else
-        asize = DSIZE * ((size + (WSIZE) + (DSIZE-1)) / DSIZE);
+    asize = mm_block_size(size);
+
+    return malloc_block(asize, sizeclass(asize), 0);
+}
 
-    /* search the freelist to allocate */
-    if ((bp = find_fit(asize)) != NULL){
+/*
+ * mm_malloc_class - malloc for callers that already know the adjusted
+ * block size asize and its size class cls, e.g. the C++ allocators in
+ * mm_allocator.hpp, which work both out at compile time. The block is
+ * exactly asize bytes, so mm_free_sized can free it by its size
+ */
+void *mm_malloc_class(size_t asize, int cls) {
+
+    checkheap(1);  // Let's make sure the heap is ok!
+    REQUIRES((asize >= 2*DSIZE) && (asize % DSIZE == 0));
+
+    /* initialize the heap */
+    if (heap_listp == NULL)
+        mm_init();
+    return malloc_block(asize, cls, 1);
+}
+
+/*
+ * malloc_block - find or make a block of asize bytes and allocate it.
+ * place hands out the whole free block when the rest is less than a
+ * block, so with exact set, a free block of asize + DSIZE bytes is not
+ * taken and the allocated block is always asize bytes
+ */
+static void *malloc_block(size_t asize, int cls, int exact){
+
+    REQUIRES(asize != 0);
+    size_t extendsize; /* require to expend heap */
+    char *bp;
+    int n;
+
+    /* block sizes are kept in a 32 bit header, leave room for the
+     * DSIZE an exact block may extend the heap by */
+    if (asize > UINT_MAX - DSIZE)
+        return NULL;
+
+    /* search the freelist to allocate, for an exact block look again
+     * when the fit is DSIZE too large, for a block of just asize bytes
+     * or else one large enough to split */
+    bp = find_fit(asize, cls);
+    if (exact && (bp != NULL) && (GET_SIZE(HDRP(bp)) == asize + DSIZE) &&
+        ((bp = find_exact(asize, cls)) == NULL))
+        bp = find_fit(asize + 2*DSIZE, sizeclass(asize + 2*DSIZE));
+    if (bp != NULL){
         place(bp, asize);
         return bp;
     }
 
-    /* no fit found, require to extend_heap */
-    extendsize = MAX(asize, CHUNKSIZE);
+    /* no fit found, release at most DEFERMISS deferred blocks one at a
+     * time until one fits, the rest are left to mm_maintain. find_fit
+     * found nothing before, so the block a release coalesces into is
+     * the only one that can fit, no need to search */
+    for (n = 0; (n < DEFERMISS) && (deferhead != NULL); n++){
+        bp = defer_release();
+        if ((GET_SIZE(HDRP(bp)) >= asize) &&
+            !(exact && (GET_SIZE(HDRP(bp)) == asize + DSIZE))){
+            place(bp, asize);
+            return bp;
+        }
+    }
+
+    /* still no fit, require to extend_heap */
+    extendsize = MAX(asize, chunksize);
+    if (exact && (extendsize == asize + DSIZE))
+        extendsize += DSIZE;
     if ((bp = extend_heap(extendsize/WSIZE)) == NULL)
         return NULL;
     place(bp, asize);
@@ -611,7 +1010,12 @@ void *malloc (size_t size) {
 }
 
 /*
- * free
+ * free - release the block at once when deferring is off. Otherwise the
+ * block stays allocated and joins the tail of the deferred free queue,
+ * the next link is saved in its payload the same way as the segregated
+ * lists. Only when the queue is full, the oldest block is released, so
+ * free does at most one coalesce, and the rest of the maintenance work
+ * is left to mm_maintain
  */
 void free (void *ptr) {
 
@@ -621,24 +1025,122 @@ void free (void *ptr) {
 
     checkheap(1);  // Let's make sure the heap is ok!
     ptr = ptr;
+
+    if (defermax == 0){
+        release(ptr, GET_SIZE(HDRP(ptr)));
+        return;
+    }
+    PUT(ptr, (unsigned long)NULL);
+    if (defertail == NULL)
+        deferhead = ptr;
+    else
+        PUT(defertail, (unsigned long)ptr);
+    defertail = ptr;
+    defercnt++;
+
+    if (defercnt > defermax)
+        defer_release();
+    return;
+}
+
+/*
+ * mm_free_sized - free a block of mm_malloc_class, size is the number
+ * of bytes it was asked for. The block size is worked out from it the
+ * same way as malloc, which is exact for those blocks, so release does
+ * not wait on the header to find the footer and the next block. With
+ * deferring on, the block goes through free like any other
+ */
+void mm_free_sized(void *ptr, size_t size) {
+
+    size_t asize;
+
+    if (ptr == NULL)
+        return;
+    checkheap(1);  // Let's make sure the heap is ok!
+    asize = mm_block_size(size);
+    REQUIRES(asize == GET_SIZE(HDRP(ptr)));
+
+    if (defermax != 0){
+        free(ptr);
+        return;
+    }
+    release(ptr, asize);
+}
+
+/*
+ * defer_pop - take the oldest block out of the deferred free queue
+ */
+static char *defer_pop(void){
+
+    REQUIRES(deferhead != NULL);
+    char *bp = deferhead;
+
+    if (NEXT_BLKP(bp) == PINIT){
+        deferhead = NULL;
+        defertail = NULL;
+    }
+    else
+        deferhead = NEXT_BLKP(bp);
+    defercnt--;
+    return bp;
+}
+
+/*
+ * defer_release - release the oldest deferred block, return the free
+ * block it ends up in
+ */
+static char *defer_release(void){
+
+    char *bp = defer_pop();
+    return release(bp, GET_SIZE(HDRP(bp)));
+}
+
+/*
+ * mm_maintain - release at most budget deferred blocks (all of them when
+ * budget is 0) and return how many are still waiting. It is meant to be
+ * called off the latency critical path, e.g. from an idle loop or a
+ * maintenance thread. The allocator has no locking of its own, so the
+ * caller must hold its own lock around mm_maintain, malloc and free
+ * when they run on different threads
+ */
+size_t mm_maintain(size_t budget) {
+
+    budget = budget;
+    size_t done = 0;
+
+    while ((deferhead != NULL) && ((budget == 0) || (done < budget))){
+        defer_release();
+        done++;
+    }
+    return defercnt;
+}
+
+/*
+ * release - really free the block of size bytes, coalesce it with its
+ * neighbors and return the free block it ends up in
+ */
+static char *release(char *ptr, size_t size){
+
+    REQUIRES(ptr != NULL);
+    REQUIRES(size == GET_SIZE(HDRP(ptr)));
     char *bp;
-    size_t size = GET_SIZE(HDRP(ptr));
 
-    /* keep the prev_alloc same */
+    /* keep the prev_alloc same, the footer and the next block come
+     * from size, not from the header */
     if (GET_PREV_ALLOC(HDRP(ptr))){
         PUT(HDRP(ptr), PACK(size, 0));
-        PUT(FTRP(ptr), PACK(size, 0));
+        PUT(ptr + size - DSIZE, PACK(size, 0));
         PUT_PREV_ALLOC(HDRP(ptr));
     }
     else{
         PUT(HDRP(ptr), PACK(size, 0));
-        PUT(FTRP(ptr), PACK(size, 0));
+        PUT(ptr + size - DSIZE, PACK(size, 0));
     }
     /* cleat the prev_alloc of next physical blk */
-    CLEAR_PREV_ALLOC(HDRP(NEXT_PHYP(ptr)));
+    CLEAR_PREV_ALLOC(HDRP(ptr + size));
 
     bp = coalesce(ptr);
-    return;
+    return bp;
 }
 
 /*
@@ -724,19 +1226,53 @@ void *realloc(void *oldptr, size_t size) {
         return malloc(size);
     }
 
+    /* the new size still fits in the slack of the old block */
+    if (size <= mm_malloc_usable_size(oldptr))
+        return oldptr;
+
     newptr = malloc(size);
     if (!newptr)
         return 0;
     
-    oldsize = GET_SIZE(HDRP(oldptr));
-    if (size < oldsize)
-        oldsize = size;
+    /* only the usable part of the old block holds payload */
+    oldsize = mm_malloc_usable_size(oldptr);
     memcpy(newptr, oldptr, oldsize);
     free(oldptr);
 
     return newptr;
 }
 
+/*
+ * mm_malloc_usable_size - return the number of payload bytes the block
+ * really owns, which may be more than requested because of the rounding
+ * in malloc and the whole free block handed out by place. Allocated
+ * blocks have no footer, so everything but the header is usable.
+ */
+size_t mm_malloc_usable_size(void *ptr) {
+
+    if (ptr == NULL)
+        return 0;
+    REQUIRES(is_block(ptr));
+    return (GET_SIZE(HDRP(ptr)) - WSIZE);
+}
+
+/*
+ * is_block - whether bp looks like an allocated block of malloc: an
+ * aligned header with the alloc bit, a size of at least a block that
+ * stays in the heap, and a next block that knows bp is allocated. An
+ * object of mm_malloc_cacheline fails it, for debug checks
+ */
+static inline int is_block(char *bp){
+
+    size_t size;
+
+    if ((bp == NULL) || !aligned(bp) || !in_heap(HDRP(bp)))
+        return 0;
+    size = GET_SIZE(HDRP(bp));
+    return GET_ALLOC(HDRP(bp)) && (size >= 2*DSIZE) &&
+           in_heap(bp + size - WSIZE) && GET_PREV_ALLOC(HDRP(bp + size));
+}
+
 /*
  * calloc - you may want to look at mm-naive.c
  */
@@ -748,102 +1284,390 @@ void *calloc (size_t nmemb, size_t size) {
     size_t bytes = nmemb * size;
     void *newptr;
 
-    newptr = malloc(bytes);
+    /* nmemb * size overflows */
+    if ((size != 0) && (bytes / size != nmemb))
+        return NULL;
+    if ((newptr = malloc(bytes)) == NULL)
+        return NULL;
     memset(newptr, 0, bytes);
 
     return newptr;
 }
 
 /*
- * Returns 0 if no errors were found, otherwise returns the error
+ * mm_malloc_cacheline - allocate size bytes starting at a cache line
+ * and padded to whole cache lines, so the object shares its lines with
+ * no other block. Objects up to CLNCLASS lines come from dedicated runs:
+ * blocks of about CLRUNSIZE bytes taken from the heap once and cut into
+ * slots of one size, which never go back to the segregated lists. A
+ * larger object gets its own block, with the distance back to the block
+ * start saved in the word in front of it. Free it with
+ * mm_free_cacheline and the same size. These objects have no header of
+ * their own, so free, realloc and mm_malloc_usable_size must not be
+ * used on them: in front of a small slot is the payload of the slot
+ * before it, which they would read as a header
+ */
+void *mm_malloc_cacheline(size_t size) {
+
+    size_t lines, slot, n, i;
+    char *run, *bp;
+    int c;
+
+    if ((size == 0) || (size > UINT_MAX))
+        return NULL;
+    lines = (size + CACHELINE - 1) / CACHELINE;
+
+    /* a large object, align a block of its own */
+    if (lines > CLNCLASS){
+        if ((run = malloc(lines * CACHELINE + CACHELINE)) == NULL)
+            return NULL;
+        bp = align(run + WSIZE, CACHELINE);
+        PUT(bp - WSIZE, bp - run);
+        return bp;
+    }
+
+    /* no free slot, cut a new run into slots */
+    c = lines - 1;
+    if (clfree[c] == NULL){
+        slot = lines * CACHELINE;
+        n = CLRUNSIZE / slot;
+        if ((run = malloc(n * slot + CACHELINE - DSIZE)) == NULL)
+            return NULL;
+        run = align(run, CACHELINE);
+        for (i = n; i-- > 0; ){
+            PUT(run + i * slot, (unsigned long)clfree[c]);
+            clfree[c] = run + i * slot;
+        }
+    }
+
+    bp = clfree[c];
+    clfree[c] = (NEXT_BLKP(bp) == PINIT) ? NULL : NEXT_BLKP(bp);
+    return bp;
+}
+
+/*
+ * mm_free_cacheline - give back an object of mm_malloc_cacheline,
+ * size is the size it was allocated with
+ */
+void mm_free_cacheline(void *ptr, size_t size) {
+
+    size_t lines;
+    int c;
+
+    if (ptr == NULL)
+        return;
+    REQUIRES(align(ptr, CACHELINE) == ptr);
+    lines = (size + CACHELINE - 1) / CACHELINE;
+    if (lines > CLNCLASS){
+        free((char *)ptr - GET((char *)ptr - WSIZE));
+        return;
+    }
+    c = lines - 1;
+    PUT(ptr, (unsigned long)clfree[c]);
+    clfree[c] = ptr;
+}
+
+/*
+ * write_all - write len bytes of buf to fd, return -1 on error
+ */
+static int write_all(int fd, const void *buf, size_t len){
+
+    const char *p = buf;
+    ssize_t n;
+
+    while (len > 0){
+        if ((n = write(fd, p, len)) < 0)
+            return -1;
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * mm_persist - save the heap to the file at path: a persist_t header
+ * with the roots, then the heap image at a page aligned offset. The
+ * deferred blocks are released first, so the queue needs no root. The
+ * file is written under a temporary name and renamed over path, so a
+ * heap attached from path keeps its mapping. Return -1 on error
+ */
+int mm_persist(const char *path) {
+
+    persist_t hdr;
+    char *base = mem_heap_lo();
+    char tmp[4096];
+    size_t pagesize = sysconf(_SC_PAGESIZE);
+    int fd, i;
+
+    if (heap_listp == NULL)
+        mm_init();
+    mm_maintain(0);
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, PERSISTMAGIC, sizeof(hdr.magic));
+    hdr.version = PERSISTVER;
+    hdr.nclass = NCLASS;
+    hdr.imageoff = (sizeof(hdr) + pagesize - 1) / pagesize * pagesize;
+    hdr.heapsize = mem_heapsize();
+    hdr.listoff = heap_listp - base;
+    for (i = 0; i < NCLASS; i++){
+        hdr.scupper[i] = mm_scupper[i];
+        hdr.scoff[i] = (sclist[i] == NULL) ? 0 : (size_t)(sclist[i] - base);
+    }
+    for (i = 0; i < CLNCLASS; i++)
+        hdr.cloff[i] = (clfree[i] == NULL) ? 0 : (size_t)(clfree[i] - base);
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return -1;
+    if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        return -1;
+    if ((write_all(fd, &hdr, sizeof(hdr)) < 0) ||
+        (lseek(fd, hdr.imageoff, SEEK_SET) < 0) ||
+        (write_all(fd, base, hdr.heapsize) < 0) || (fsync(fd) < 0)){
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    close(fd);
+    if (rename(tmp, path) < 0){
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * bad_root - whether a root offset of a persisted heap cannot point at
+ * a block in a heap image of heapsize bytes, 0 stands for NULL
+ */
+static int bad_root(size_t off, size_t heapsize){
+    return (off != 0) && ((off >= heapsize) || (off % DSIZE != 0));
+}
+
+/*
+ * mm_attach - replace the heap by the one saved in the file at path,
+ * and resume allocating from it. The image is mapped copy-on-write at
+ * the heap start, so attaching costs the same for any heap size and
+ * pages are only read when touched; changes stay in memory until the
+ * next mm_persist. The side indexes are not saved, each one is built
+ * from its list when findfit first searches that class. The file must
+ * be made with the same size class table.
+ * Untouched pages are still read from the file, so it must not be
+ * truncated or rewritten in place (e.g. by cp) while the heap is
+ * attached, or touching them raises SIGBUS; mm_persist is safe, since
+ * it renames a new file over path.
+ * Return -1 on error: when the file header or its roots are bad, the
+ * current heap stays in use as it was; when the image cannot be mapped
+ * or read, the heap is left empty
+ */
+int mm_attach(const char *path) {
+
+    persist_t hdr;
+    struct stat st;
+    char *base;
+    size_t done;
+    ssize_t n;
+    int fd, i, bad;
+
+    if ((fd = open(path, O_RDONLY)) < 0)
+        return -1;
+    /* the image must be all in the file, or touching the mapping past
+     * its end faults, and every root must point into the image */
+    bad = (fstat(fd, &st) < 0) ||
+          (read(fd, &hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) ||
+          memcmp(hdr.magic, PERSISTMAGIC, sizeof(hdr.magic)) ||
+          (hdr.version != PERSISTVER) || (hdr.nclass != NCLASS) ||
+          memcmp(hdr.scupper, mm_scupper, sizeof(mm_scupper)) ||
+          (hdr.heapsize == 0) || (hdr.imageoff > (size_t)st.st_size) ||
+          (hdr.heapsize > (size_t)st.st_size - hdr.imageoff) ||
+          (hdr.listoff == 0) || bad_root(hdr.listoff, hdr.heapsize);
+    for (i = 0; !bad && (i < NCLASS); i++)
+        bad = bad_root(hdr.scoff[i], hdr.heapsize);
+    for (i = 0; !bad && (i < CLNCLASS); i++)
+        bad = bad_root(hdr.cloff[i], hdr.heapsize);
+    if (bad){
+        close(fd);
+        return -1;
+    }
+
+    /* the heap starts again from the image */
+    mem_reset_brk();
+    heap_listp = NULL;
+    if ((base = mem_sbrk(hdr.heapsize)) == (void *)(-1)){
+        close(fd);
+        return -1;
+    }
+    if (mmap(base, hdr.heapsize, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_FIXED, fd, hdr.imageoff) == MAP_FAILED){
+        /* cannot map it, read it instead */
+        for (done = 0; done < hdr.heapsize; done += n){
+            n = pread(fd, base + done, hdr.heapsize - done,
+                      hdr.imageoff + done);
+            if (n <= 0){
+                close(fd);
+                mem_reset_brk();
+                return -1;
+            }
+        }
+    }
+    close(fd);
+
+    /* restore the roots from their offsets */
+    heap_listp = base + hdr.listoff;
+    for (i = 0; i < NCLASS; i++){
+        sclist[i] = (hdr.scoff[i] == 0) ? NULL : base + hdr.scoff[i];
+        sxcnt[i] = 0;
+        sxbad[i] = 0;
+        sxstale[i] = sxindexed(i) && (sclist[i] != NULL);
+    }
+    for (i = 0; i < CLNCLASS; i++)
+        clfree[i] = (hdr.cloff[i] == 0) ? NULL : base + hdr.cloff[i];
+    deferhead = NULL;
+    defertail = NULL;
+    defercnt = 0;
+    parse_conf(getenv(CONFENV));
+    return 0;
+}
+
+/*
+ * Returns 0 if no errors were found, otherwise returns the number of
+ * errors, each of them is also printed. verbose prints every block too
  */
 int mm_checkheap(int verbose) {
 
     verbose = verbose;
     char *bp;
+    int errors = 0;
+
+    /* nothing to check before the heap is initialized */
+    if (heap_listp == NULL)
+        return 0;
     if (verbose)
         printf("Heap (%p:)\n", heap_listp);
     
     /* check prologue */
-    if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) || !GET_ALLOC(HDRP(heap_listp)))
+    if ((GET_SIZE(HDRP(heap_listp)) != DSIZE) ||
+        !GET_ALLOC(HDRP(heap_listp))){
         printf("Bad prologue header\n");
-        checkblock(heap_listp);
+        errors++;
+    }
     /* check block */
     for (bp = heap_listp; GET_SIZE(HDRP(bp)) > 0; bp = NEXT_PHYP(bp)){
         if (verbose)
             printblock(bp);
-        checkblock(bp);
+        errors += checkblock(bp);
     }
     /* check epilogue */
     if (verbose)
         printblock(bp);
-    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp))))
+    if ((GET_SIZE(HDRP(bp)) != 0) || !(GET_ALLOC(HDRP(bp)))){
         printf("Bad epilogue header\n");
+        errors++;
+    }
+    /* check deferred free queue */
+    for (bp = deferhead; (bp != NULL) && (bp != PINIT); bp = NEXT_BLKP(bp)){
+        if (!GET_ALLOC(HDRP(bp))){
+            printf("deferred queue contains free block\n");
+            errors++;
+        }
+    }
+    /* check cache line slot lists */
+    int i;
+    for (i = 0; i < CLNCLASS; i++){
+        for (bp = clfree[i]; (bp != NULL) && (bp != PINIT);
+             bp = NEXT_BLKP(bp)){
+            if (align(bp, CACHELINE) != bp){
+                printf("cache line slot %p is not aligned\n", bp);
+                errors++;
+            }
+        }
+    }
     /* check segregated list */
-    if (verbose)
-        checklist();
-    return 0;
+    errors += checklist();
+    return errors;
 }
    
 /*
- * sub_functionof checklist,check single list
+ * sub_functionof checklist,check single list, return the number of
+ * errors
  */ 
-static void check_list(char *scp, size_t lowsize, size_t upsize){
+static int check_list(char *scp, size_t lowsize, size_t upsize){
    
     scp = scp;
     lowsize = lowsize;
     upsize = upsize;
     char *p;
+    int errors = 0;
     for (p = scp; (p != NULL) && (p != PINIT); p = NEXT_BLKP(p)){
 
         REQUIRES(in_heap(p));
-        if ((NEXT_BLKP(p) != PINIT) && (p != (PREV_BLKP(NEXT_BLKP(p)))))
+        if (GET_CYCLE(HDRP(p)) != 0){
+            printf("with cycle in the list\n");
+            return errors + 1;
+        }
+        if ((NEXT_BLKP(p) != PINIT) && (p != (PREV_BLKP(NEXT_BLKP(p))))){
             printf("prev/next pointers are not consistent\n");
-        if (GET_ALLOC(HDRP(p)) != 0)
+            errors++;
+        }
+        if (GET_ALLOC(HDRP(p)) != 0){
             printf("free list contains allocated block\n");
-        if (!GET_ALLOC(HDRP(NEXT_PHYP(p))) || !GET_PREV_ALLOC(HDRP(p)))
+            errors++;
+        }
+        if (!GET_ALLOC(HDRP(NEXT_PHYP(p))) || !GET_PREV_ALLOC(HDRP(p))){
             printf("contiguous free blocks\n");
-        if (GET_SIZE(HDRP(p)) <= lowsize)
-            printf("free block containing in wrong list\n");
-        if (GET_SIZE(HDRP(p)) > upsize)
+            errors++;
+        }
+        if ((GET_SIZE(HDRP(p)) <= lowsize) || (GET_SIZE(HDRP(p)) > upsize)){
             printf("free block containing in wrong list\n");
-        if (GET_CYCLE(HDRP(p)) == 1)
-            printf("with cycle in the list\n");
+            errors++;
+        }
 
         /* set the last third bit as 1, which means the free block 
          * has been checked in the list before */
         PUT_CYCLE(HDRP(p));
     }
-        return;
+    return errors;
 }
 
 /*
- * checklist
+ * checklist, return the number of errors
  */
-static void checklist(void){
+static int checklist(void){
 
     /* check each list */
-    check_list(sc16p, SIZE0, SIZE16);
-    check_list(sc32p, SIZE16, SIZE32);
-    check_list(sc64p, SIZE32, SIZE64);
-    check_list(sc128p, SIZE64, SIZE128);
-    check_list(sc256p, SIZE128, SIZE256);
-    check_list(sc512p, SIZE256, SIZE512);
-    check_list(sc1024p, SIZE512, SIZE1024);
-    check_list(sc2048p, SIZE1024, SIZE2048);
-    check_list(sc2049p, SIZE2048, SIZEMAX);
+    int i, errors = 0;
+    unsigned int j;
+    char *bp;
+    for (i = 0; i < NCLASS; i++)
+        errors += check_list(sclist[i], sclower(i), mm_scupper[i]);
+
+    /* check the side index matches the blocks it points to */
+    for (i = 0; i < NCLASS; i++){
+        if (!sxindexed(i))
+            continue;
+        for (j = 0; j < sxcnt[i]; j++){
+            bp = (char *)((unsigned long)sxoff[i][j] | 0x800000000);
+            if ((GET(bp + DSIZE) != j) ||
+                (GET_SIZE(HDRP(bp)) != sxsize[i][j]) || GET_ALLOC(HDRP(bp))){
+                printf("side index entry %u of list %d is wrong\n", j, i);
+                errors++;
+            }
+        }
+    }
 
     /* check whether all free blocks are all in the lists 
      * according to the cycle bit */
     char *p;
     for (p = heap_listp + DSIZE; GET_SIZE(HDRP(p)) != 0; p = NEXT_PHYP(p)){
         if (!GET_ALLOC(HDRP(p))){
-            if (!GET_CYCLE(HDRP(p)))
+            if (!GET_CYCLE(HDRP(p))){
                 printf("free block not in the list\n");
+                errors++;
+            }
             CLEAR_CYCLE(HDRP(p));
         }
     }
-    return;
+    return errors;
 }
 
 static void printblock(void *bp){
@@ -867,10 +1691,13 @@ static void printblock(void *bp){
  * since the footer has been removed, there's no need to check 
  * the matching of footer and header
  */
-static void checkblock(void *bp){
+static int checkblock(void *bp){
 
     REQUIRES(bp != NULL);
     bp = bp;
-    if ((size_t)bp % 8)
+    if ((size_t)bp % 8){
         printf("Error: %p is not double word aligned\n", bp);
+        return 1;
+    }
+    return 0;
 }
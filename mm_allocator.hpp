@@ -0,0 +1,181 @@
+/*
+ * mm_allocator.hpp
+ *
+ * C++ front ends of the allocator in mm.c (C++17):
+ *   mm::heap_resource   a std::pmr::memory_resource over the heap
+ *   mm::allocator<T>    an STL allocator over the heap
+ *
+ * Both compute the block size malloc would use and its size class with
+ * the helpers of mm_ext.h, and call mm_malloc_class and mm_free_sized,
+ * which skip the size adjustment and class lookup of malloc and the
+ * header read of free. When the size is a compile time constant
+ * (allocator<T> with one element, the case of every list, map and
+ * unordered_map node) the class is picked at compile time. The heap
+ * gives 8 byte alignment, a larger power of 2 alignment is made by
+ * over-allocating, so heap_resource works with the max_align_t default
+ * of memory_resource and under the standard pool resources.
+ *
+ * The allocator has no locking, so a program using it from more than
+ * one thread must serialize the calls itself.
+ */
+
+#ifndef MM_ALLOCATOR_HPP
+#define MM_ALLOCATOR_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory_resource>
+#include <new>
+
+#include "mm_ext.h"
+
+namespace mm {
+
+/* alignment of every payload of the heap */
+constexpr std::size_t alignment = 8;
+
+/* block size malloc uses for a request of size bytes */
+constexpr std::size_t block_size(std::size_t size) {
+    return mm_block_size(size);
+}
+
+/* size class of a block of asize bytes */
+constexpr int size_class(std::size_t asize) {
+    return mm_size_class(asize);
+}
+
+/* allocate size bytes, with the size class picked at run time */
+inline void *allocate_bytes(std::size_t size) {
+    if (size == 0)
+        size = 1;
+    /* block sizes are kept in a 32 bit header */
+    if (size > std::numeric_limits<unsigned int>::max() - 16)
+        throw std::bad_alloc();
+    std::size_t asize = block_size(size);
+    void *p = mm_malloc_class(asize, size_class(asize));
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+/* allocate Size bytes, with the size class picked at compile time */
+template <std::size_t Size>
+inline void *allocate_fixed() {
+    constexpr std::size_t asize = block_size(Size == 0 ? 1 : Size);
+    constexpr int cls = size_class(asize);
+    void *p = mm_malloc_class(asize, cls);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+inline void deallocate_bytes(void *p, std::size_t size) noexcept {
+    mm_free_sized(p, size);
+}
+
+/*
+ * allocate size bytes at a multiple of align, a power of 2 above
+ * alignment: the block gets align more bytes, the object starts at the
+ * first multiple of align past the first 4 bytes of the block, and the
+ * distance back to the block start is saved in the 4 bytes in front of
+ * the object, like the large objects of mm_malloc_cacheline
+ */
+inline void *allocate_aligned(std::size_t size, std::size_t align) {
+    if ((align & (align - 1)) != 0 ||
+        size > std::numeric_limits<std::size_t>::max() - align)
+        throw std::bad_alloc();
+    char *block = static_cast<char *>(allocate_bytes(size + align));
+    std::uintptr_t at = reinterpret_cast<std::uintptr_t>(block) + 4;
+    char *p = block + (((at + align - 1) & ~(align - 1)) - at) + 4;
+    std::uint32_t off = static_cast<std::uint32_t>(p - block);
+    std::memcpy(p - 4, &off, sizeof(off));
+    return p;
+}
+
+inline void deallocate_aligned(void *p, std::size_t size,
+                               std::size_t align) noexcept {
+    std::uint32_t off;
+    std::memcpy(&off, static_cast<char *>(p) - 4, sizeof(off));
+    deallocate_bytes(static_cast<char *>(p) - off, size + align);
+}
+
+/*
+ * heap_resource - memory_resource over the heap, all instances are
+ * equal since there is only one heap
+ */
+class heap_resource : public std::pmr::memory_resource {
+protected:
+    void *do_allocate(std::size_t bytes, std::size_t align) override {
+        if (align > alignment)
+            return allocate_aligned(bytes, align);
+        return allocate_bytes(bytes);
+    }
+
+    void do_deallocate(void *p, std::size_t bytes,
+                       std::size_t align) override {
+        if (align > alignment)
+            deallocate_aligned(p, bytes, align);
+        else
+            deallocate_bytes(p, bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource &other) const
+        noexcept override {
+        return dynamic_cast<const heap_resource *>(&other) != nullptr;
+    }
+};
+
+/* the shared heap_resource, e.g. for std::pmr::set_default_resource */
+inline heap_resource *heap() noexcept {
+    static heap_resource resource;
+    return &resource;
+}
+
+/*
+ * allocator - STL allocator over the heap, single element requests take
+ * the size class of sizeof(T) picked at compile time, and a T aligned
+ * above alignment is over-allocated
+ */
+template <class T>
+class allocator {
+public:
+    using value_type = T;
+
+    allocator() noexcept = default;
+    template <class U>
+    allocator(const allocator<U> &) noexcept {}
+
+    T *allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_alloc();
+        if constexpr (alignof(T) > alignment)
+            return static_cast<T *>(allocate_aligned(n * sizeof(T),
+                                                     alignof(T)));
+        if (n == 1)
+            return static_cast<T *>(allocate_fixed<sizeof(T)>());
+        return static_cast<T *>(allocate_bytes(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t n) noexcept {
+        if constexpr (alignof(T) > alignment)
+            deallocate_aligned(p, n * sizeof(T), alignof(T));
+        else
+            deallocate_bytes(p, n * sizeof(T));
+    }
+};
+
+template <class T, class U>
+inline bool operator==(const allocator<T> &, const allocator<U> &) noexcept {
+    return true;
+}
+
+template <class T, class U>
+inline bool operator!=(const allocator<T> &, const allocator<U> &) noexcept {
+    return false;
+}
+
+} // namespace mm
+
+#endif
@@ -0,0 +1,441 @@
+/*
+ * mm_bench.c
+ *
+ * Microbenchmarks for the paths of the allocator in mm.c. Every
+ * scenario starts from a fresh heap, times each malloc, free, realloc
+ * or calloc call with the cycle counter and reports a latency histogram
+ * of it.
+ *
+ * Build it with mm.c compiled with -DDRIVER, e.g.
+ *   gcc -O2 -DDRIVER -DNDEBUG -o mm_bench mm_bench.c mm.c memlib.c -lpthread
+ *
+ * Usage: mm_bench [-c] [-n iterations] [-s scenario]
+ *   -c   print CSV lines instead of the table, for regression tracking
+ *   -n   iterations per scenario (default 100000)
+ *   -s   run only the scenarios whose name starts with this string
+ *
+ * Scenarios
+ *   pingpong/N   malloc then free of N bytes, the largest size of each
+ *                size class in mm_sizeclass.h, and two sizes of the last
+ *   order/lifo   free a batch of mixed sizes in reverse order
+ *   order/fifo   free a batch of mixed sizes in allocation order
+ *   order/random free a batch of mixed sizes in random order
+ *   realloc      grow one block step by step up to 64 KB
+ *   calloc/fresh calloc out of a newly extended heap
+ *   calloc/reuse calloc out of blocks that were just freed
+ *   frag         malloc from a long list of large free blocks split
+ *                by pinned small ones, so findfit walks the last list
+ *   prodcons     one thread mallocs, another frees, calls serialized by
+ *                a mutex since the allocator has no locking of its own
+ *
+ * Latencies are in cycles (nanoseconds where there is no rdtsc). The
+ * histogram has 8 steps per power of 2, so percentiles are within 10%.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_sizeclass.h"
+
+#define SUBBITS 3
+#define NBUCKET (64 << SUBBITS)
+#define BATCH 4096
+#define RING 1024
+#define FRAGN 1024
+
+/* latency histogram of one operation */
+typedef struct {
+    uint64_t bucket[NBUCKET];
+    uint64_t count, sum, min, max;
+} hist_t;
+
+static int csv = 0;
+static long iters = 100000;
+static const char *only = NULL;
+static pthread_mutex_t heaplock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline uint64_t ticks(void){
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+    __asm__ __volatile__("lfence\n\trdtsc" : "=a"(lo), "=d"(hi) :: "memory");
+    return ((uint64_t)hi << 32) | lo;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+static int bucket_of(uint64_t v){
+    int msb;
+    if (v < (1u << SUBBITS))
+        return (int)v;
+    msb = 63 - __builtin_clzll(v);
+    return ((msb - SUBBITS + 1) << SUBBITS) |
+           (int)((v >> (msb - SUBBITS)) & ((1u << SUBBITS) - 1));
+}
+
+/* smallest value of the bucket */
+static uint64_t bucket_low(int b){
+    int e = b >> SUBBITS;
+    if (e == 0)
+        return (uint64_t)b;
+    return ((uint64_t)((1 << SUBBITS) | (b & ((1 << SUBBITS) - 1))))
+           << (e - 1);
+}
+
+static void hist_reset(hist_t *h){
+    memset(h, 0, sizeof(*h));
+    h->min = UINT64_MAX;
+}
+
+static inline void hist_add(hist_t *h, uint64_t v){
+    h->bucket[bucket_of(v)]++;
+    h->count++;
+    h->sum += v;
+    if (v < h->min)
+        h->min = v;
+    if (v > h->max)
+        h->max = v;
+}
+
+static uint64_t hist_pct(const hist_t *h, double p){
+    uint64_t want = (uint64_t)(p * h->count), seen = 0;
+    int b;
+    for (b = 0; b < NBUCKET; b++){
+        seen += h->bucket[b];
+        if (seen > want)
+            return bucket_low(b);
+    }
+    return h->max;
+}
+
+static void report(const char *scenario, const char *op, const hist_t *h){
+    if (h->count == 0)
+        return;
+    if (csv)
+        printf("%s,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%.1f,%lu\n", scenario, op,
+               (unsigned long)h->count, (unsigned long)h->min,
+               (unsigned long)hist_pct(h, 0.5),
+               (unsigned long)hist_pct(h, 0.9),
+               (unsigned long)hist_pct(h, 0.99),
+               (unsigned long)hist_pct(h, 0.999), (unsigned long)h->max,
+               (double)h->sum / h->count, (unsigned long)mem_heapsize());
+    else
+        printf("%-16s %-8s %9lu %7lu %7lu %7lu %7lu %8lu %9lu %9.1f\n",
+               scenario, op, (unsigned long)h->count, (unsigned long)h->min,
+               (unsigned long)hist_pct(h, 0.5),
+               (unsigned long)hist_pct(h, 0.9),
+               (unsigned long)hist_pct(h, 0.99),
+               (unsigned long)hist_pct(h, 0.999), (unsigned long)h->max,
+               (double)h->sum / h->count);
+}
+
+static int selected(const char *name){
+    return (only == NULL) || !strncmp(name, only, strlen(only));
+}
+
+/* start every scenario from an empty heap */
+static void fresh_heap(void){
+    mem_reset_brk();
+    if (mm_init() < 0){
+        fprintf(stderr, "mm_bench: mm_init failed\n");
+        exit(1);
+    }
+}
+
+/* xorshift, so every run sees the same sizes and orders */
+static uint64_t rng = 88172645463325252ULL;
+static inline uint64_t next_rand(void){
+    rng ^= rng << 13;
+    rng ^= rng >> 7;
+    rng ^= rng << 17;
+    return rng;
+}
+
+/* a size mix weighted to small blocks, up to 4 KB */
+static size_t mixed_size(void){
+    uint64_t r = next_rand();
+    return 1 + (r >> 8) % ((r & 3) ? 128 : 4096);
+}
+
+static void *timed_malloc(hist_t *h, size_t size){
+    uint64_t t = ticks();
+    void *p = mm_malloc(size);
+    hist_add(h, ticks() - t);
+    if (p == NULL){
+        fprintf(stderr, "mm_bench: out of memory\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void timed_free(hist_t *h, void *p){
+    uint64_t t = ticks();
+    mm_free(p);
+    hist_add(h, ticks() - t);
+}
+
+static void bench_pingpong(void){
+    static const size_t upper[MM_NCLASS] = MM_SCUPPER_INIT;
+    size_t sizes[MM_NCLASS + 1], nsize = 0, lower;
+    char name[32];
+    hist_t hm, hf;
+    size_t i;
+    long n;
+
+    /* a request of upper - 8 bytes gets a block of exactly upper bytes,
+     * the last class has no upper size, so take twice and eight times
+     * the size it starts from */
+    for (i = 0; i + 1 < MM_NCLASS; i++)
+        sizes[nsize++] = upper[i] - 8;
+#if MM_NCLASS > 1
+    lower = upper[MM_NCLASS - 2];
+#else
+    lower = 2048;
+#endif
+    sizes[nsize++] = 2 * lower;
+    sizes[nsize++] = 8 * lower;
+
+    for (i = 0; i < nsize; i++){
+        snprintf(name, sizeof(name), "pingpong/%lu", (unsigned long)sizes[i]);
+        if (!selected(name))
+            continue;
+        fresh_heap();
+        hist_reset(&hm);
+        hist_reset(&hf);
+        for (n = 0; n < iters; n++)
+            timed_free(&hf, timed_malloc(&hm, sizes[i]));
+        report(name, "malloc", &hm);
+        report(name, "free", &hf);
+    }
+}
+
+static void bench_order(void){
+    static const char *names[] = {"order/lifo", "order/fifo", "order/random"};
+    static void *blk[BATCH];
+    hist_t hm, hf;
+    int mode, i, j;
+    long n;
+    void *tmp;
+
+    for (mode = 0; mode < 3; mode++){
+        if (!selected(names[mode]))
+            continue;
+        fresh_heap();
+        hist_reset(&hm);
+        hist_reset(&hf);
+        for (n = 0; n < iters; n += BATCH){
+            for (i = 0; i < BATCH; i++)
+                blk[i] = timed_malloc(&hm, mixed_size());
+            if (mode == 2){
+                for (i = BATCH - 1; i > 0; i--){
+                    j = (int)(next_rand() % (uint64_t)(i + 1));
+                    tmp = blk[i];
+                    blk[i] = blk[j];
+                    blk[j] = tmp;
+                }
+            }
+            for (i = 0; i < BATCH; i++)
+                timed_free(&hf, blk[(mode == 0) ? BATCH - 1 - i : i]);
+        }
+        report(names[mode], "malloc", &hm);
+        report(names[mode], "free", &hf);
+    }
+}
+
+static void bench_realloc(void){
+    hist_t hr;
+    uint64_t t;
+    size_t size;
+    long n = 0;
+    char *p;
+
+    if (!selected("realloc"))
+        return;
+    fresh_heap();
+    hist_reset(&hr);
+    while (n < iters){
+        p = NULL;
+        for (size = 16; (size <= 65536) && (n < iters); size += size / 8 + 8){
+            t = ticks();
+            p = mm_realloc(p, size);
+            hist_add(&hr, ticks() - t);
+            if (p == NULL){
+                fprintf(stderr, "mm_bench: out of memory\n");
+                exit(1);
+            }
+            p[size - 1] = 1;
+            n++;
+        }
+        mm_free(p);
+    }
+    report("realloc", "realloc", &hr);
+}
+
+static void bench_calloc(void){
+    static void *blk[BATCH];
+    hist_t hc;
+    uint64_t t;
+    int reuse, i;
+    long n;
+
+    for (reuse = 0; reuse < 2; reuse++){
+        const char *name = reuse ? "calloc/reuse" : "calloc/fresh";
+        if (!selected(name))
+            continue;
+        hist_reset(&hc);
+        for (n = 0; n < iters; n += BATCH){
+            fresh_heap();
+            if (reuse){
+                for (i = 0; i < BATCH; i++)
+                    blk[i] = mm_malloc(256);
+                for (i = 0; i < BATCH; i++)
+                    mm_free(blk[i]);
+            }
+            for (i = 0; i < BATCH; i++){
+                t = ticks();
+                blk[i] = mm_calloc(1, 256);
+                hist_add(&hc, ticks() - t);
+            }
+        }
+        report(name, "calloc", &hc);
+    }
+}
+
+static void bench_frag(void){
+    static void *big[FRAGN], *pin[FRAGN];
+    hist_t hm, hf;
+    int i;
+    long n;
+    void *p;
+
+    if (!selected("frag"))
+        return;
+    fresh_heap();
+    hist_reset(&hm);
+    hist_reset(&hf);
+    /* large blocks of growing size kept apart by small pinned ones */
+    for (i = 0; i < FRAGN; i++){
+        big[i] = mm_malloc(2100 + 8 * (size_t)i);
+        pin[i] = mm_malloc(16);
+    }
+    for (i = 0; i < FRAGN; i++)
+        mm_free(big[i]);
+    /* ask for more than most of them hold, then give it back */
+    for (n = 0; n < iters; n++){
+        p = timed_malloc(&hm, 2100 + 8 * (size_t)(FRAGN - 1 - n % 64));
+        timed_free(&hf, p);
+    }
+    report("frag", "malloc", &hm);
+    report("frag", "free", &hf);
+    for (i = 0; i < FRAGN; i++)
+        mm_free(pin[i]);
+}
+
+/* ring buffer between the producer and the consumer */
+static void *ring[RING];
+static volatile long ring_head = 0, ring_tail = 0;
+static hist_t pc_malloc, pc_free;
+
+static void *producer(void *arg){
+    long n;
+    uint64_t t;
+    void *p;
+
+    (void)arg;
+    for (n = 0; n < iters; n++){
+        while (ring_head - ring_tail == RING)
+            sched_yield();
+        t = ticks();
+        pthread_mutex_lock(&heaplock);
+        p = mm_malloc(mixed_size());
+        pthread_mutex_unlock(&heaplock);
+        hist_add(&pc_malloc, ticks() - t);
+        ring[ring_head % RING] = p;
+        __sync_synchronize();
+        ring_head++;
+    }
+    return NULL;
+}
+
+static void *consumer(void *arg){
+    long n;
+    uint64_t t;
+    void *p;
+
+    (void)arg;
+    for (n = 0; n < iters; n++){
+        while (ring_head == ring_tail)
+            sched_yield();
+        __sync_synchronize();
+        p = ring[ring_tail % RING];
+        ring_tail++;
+        t = ticks();
+        pthread_mutex_lock(&heaplock);
+        mm_free(p);
+        pthread_mutex_unlock(&heaplock);
+        hist_add(&pc_free, ticks() - t);
+    }
+    return NULL;
+}
+
+static void bench_prodcons(void){
+    pthread_t prod, cons;
+
+    if (!selected("prodcons"))
+        return;
+    fresh_heap();
+    hist_reset(&pc_malloc);
+    hist_reset(&pc_free);
+    ring_head = ring_tail = 0;
+    pthread_create(&prod, NULL, producer, NULL);
+    pthread_create(&cons, NULL, consumer, NULL);
+    pthread_join(prod, NULL);
+    pthread_join(cons, NULL);
+    report("prodcons", "malloc", &pc_malloc);
+    report("prodcons", "free", &pc_free);
+}
+
+int main(int argc, char **argv){
+
+    int opt;
+
+    while ((opt = getopt(argc, argv, "cn:s:")) != -1){
+        switch (opt){
+        case 'c': csv = 1; break;
+        case 'n': iters = atol(optarg); break;
+        case 's': only = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-c] [-n iterations] [-s scenario]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (iters <= 0)
+        iters = 1;
+
+    mem_init();
+    if (csv)
+        printf("scenario,op,count,min,p50,p90,p99,p999,max,mean,heapsize\n");
+    else
+        printf("%-16s %-8s %9s %7s %7s %7s %7s %8s %9s %9s\n", "scenario",
+               "op", "count", "min", "p50", "p90", "p99", "p99.9", "max",
+               "mean");
+    bench_pingpong();
+    bench_order();
+    bench_realloc();
+    bench_calloc();
+    bench_frag();
+    bench_prodcons();
+    mem_deinit();
+    return 0;
+}
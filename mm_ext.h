@@ -0,0 +1,66 @@
+/*
+ * mm_ext.h
+ *
+ * Extensions of the allocator in mm.c beyond the interface of mm.h,
+ * shared by mm.c, the C++ front ends in mm_allocator.hpp and the tools,
+ * so there is one declaration of each. See mm.c for what they do.
+ *
+ * It also holds the one copy of the block size rounding of malloc and
+ * of the size class lookup, which mm_free_sized relies on matching the
+ * blocks malloc made. They are static inline in C and constexpr in C++,
+ * so the C++ front ends can pick the class at compile time.
+ */
+
+#ifndef MM_EXT_H
+#define MM_EXT_H
+
+#include <stddef.h>
+
+#include "mm_sizeclass.h"
+
+#ifdef __cplusplus
+#define MM_CONSTEXPR constexpr
+#else
+#define MM_CONSTEXPR
+#endif
+
+/* upper block size of each size class */
+static MM_CONSTEXPR const size_t mm_scupper[MM_NCLASS] = MM_SCUPPER_INIT;
+
+/*
+ * mm_block_size - block size malloc uses for a request of size bytes:
+ * the payload and a 4 byte header rounded up to 8, at least 16
+ */
+static inline MM_CONSTEXPR size_t mm_block_size(size_t size){
+    return (size <= 8) ? 16 : 8 * ((size + 4 + 7) / 8);
+}
+
+/*
+ * mm_size_class - size class of a block of asize bytes, the first one
+ * whose upper size is not less than asize
+ */
+static inline MM_CONSTEXPR int mm_size_class(size_t asize){
+    int i = 0;
+    while (asize > mm_scupper[i])
+        i++;
+    return i;
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+size_t mm_malloc_usable_size(void *ptr);
+size_t mm_maintain(size_t budget);
+void *mm_malloc_class(size_t asize, int cls);
+void mm_free_sized(void *ptr, size_t size);
+void *mm_malloc_cacheline(size_t size);
+void mm_free_cacheline(void *ptr, size_t size);
+int mm_persist(const char *path);
+int mm_attach(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
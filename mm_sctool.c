@@ -0,0 +1,269 @@
+/*
+ * mm_sctool.c
+ *
+ * Offline tool that picks the size class table of the segregated lists
+ * in mm.c for a workload, and writes it as mm_sizeclass.h.
+ *
+ * Usage: mm_sctool [-k classes] [-l lambda] [-H] [-o file] file...
+ *
+ * Each file is an allocation trace in the driver format (four header
+ * numbers, then lines "a id size", "r id size" and "f id"), or with -H
+ * a size histogram with one "size count" pair per line. Request sizes
+ * are turned into block sizes by mm_block_size, as malloc does, and the
+ * table is chosen by dynamic programming over the sorted block sizes to
+ * minimize, summed over all classes,
+ *
+ *   slack / total bytes + lambda * skips / total requests
+ *
+ * in which slack is the bytes between each request and the largest
+ * block size of its class (what a fit in that list may leave behind,
+ * either as internal fragmentation or as a split remainder), and skips
+ * is the number of request pairs of different size in the same class,
+ * which grows with the blocks findfit has to walk past. A larger lambda
+ * gives narrower classes around the hot sizes.
+ *
+ * The last class always ends at the largest size_t value, so every
+ * block has a list.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm_ext.h"
+
+#define DSIZE 8
+#define MAXCLASS 64
+/* distinct sizes the search works on, more ones are merged */
+#define MAXSIZES 4096
+
+/* one distinct block size and its request count */
+typedef struct {
+    size_t size;
+    double count;
+} bucket_t;
+
+static bucket_t *hist = NULL;
+static size_t nhist = 0, caphist = 0;
+
+static void add(size_t size, double count){
+    if (nhist == caphist){
+        caphist = caphist ? 2 * caphist : 1024;
+        hist = realloc(hist, caphist * sizeof(bucket_t));
+        if (hist == NULL){
+            fprintf(stderr, "mm_sctool: out of memory\n");
+            exit(1);
+        }
+    }
+    hist[nhist].size = mm_block_size(size);
+    hist[nhist].count = count;
+    nhist++;
+}
+
+/* read a driver trace, return -1 on error */
+static int read_trace(FILE *fp){
+    int header[4], i;
+    char type;
+    unsigned long id, size;
+
+    for (i = 0; i < 4; i++){
+        if (fscanf(fp, "%d", &header[i]) != 1)
+            return -1;
+    }
+    while (fscanf(fp, " %c", &type) == 1){
+        if ((type == 'a') || (type == 'r')){
+            if (fscanf(fp, "%lu %lu", &id, &size) != 2)
+                return -1;
+            if (size != 0)
+                add(size, 1);
+        }
+        else if (type == 'f'){
+            if (fscanf(fp, "%lu", &id) != 1)
+                return -1;
+        }
+        else
+            return -1;
+    }
+    return 0;
+}
+
+/* read a "size count" histogram, return -1 on error */
+static int read_hist(FILE *fp){
+    unsigned long size;
+    double count;
+    int n;
+
+    while ((n = fscanf(fp, "%lu %lf", &size, &count)) == 2){
+        if ((size != 0) && (count > 0))
+            add(size, count);
+    }
+    return (n == EOF) ? 0 : -1;
+}
+
+static int cmp_bucket(const void *a, const void *b){
+    size_t x = ((const bucket_t *)a)->size, y = ((const bucket_t *)b)->size;
+    return (x > y) - (x < y);
+}
+
+/* sort the histogram and merge equal sizes */
+static void merge(void){
+    size_t i, n = 0;
+
+    qsort(hist, nhist, sizeof(bucket_t), cmp_bucket);
+    for (i = 0; i < nhist; i++){
+        if ((n > 0) && (hist[n-1].size == hist[i].size))
+            hist[n-1].count += hist[i].count;
+        else
+            hist[n++] = hist[i];
+    }
+    nhist = n;
+}
+
+/* round size up to one of 16 steps per power of 2 */
+static size_t coarse(size_t size){
+    size_t step = DSIZE;
+    while (step * 32 <= size)
+        step *= 2;
+    return (size + step - 1) / step * step;
+}
+
+int main(int argc, char **argv){
+
+    int opt, k = 9, histmode = 0, c;
+    double lambda = 1.0;
+    const char *out = NULL;
+    FILE *fp;
+    size_t i, j, m;
+    double *cnt, *byt, *sq, *best, *cost, ctot, btot;
+    size_t *from, upper[MAXCLASS];
+
+    while ((opt = getopt(argc, argv, "k:l:Ho:")) != -1){
+        switch (opt){
+        case 'k': k = atoi(optarg); break;
+        case 'l': lambda = atof(optarg); break;
+        case 'H': histmode = 1; break;
+        case 'o': out = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-k classes] [-l lambda] [-H] "
+                    "[-o file] file...\n", argv[0]);
+            return 1;
+        }
+    }
+    if ((optind >= argc) || (k < 1) || (k > MAXCLASS)){
+        fprintf(stderr, "usage: %s [-k classes] [-l lambda] [-H] "
+                "[-o file] file...\n", argv[0]);
+        return 1;
+    }
+
+    for (; optind < argc; optind++){
+        if ((fp = fopen(argv[optind], "r")) == NULL){
+            perror(argv[optind]);
+            return 1;
+        }
+        if ((histmode ? read_hist(fp) : read_trace(fp)) < 0){
+            fprintf(stderr, "mm_sctool: bad input in %s\n", argv[optind]);
+            return 1;
+        }
+        fclose(fp);
+    }
+    if (nhist == 0){
+        fprintf(stderr, "mm_sctool: no allocation found\n");
+        return 1;
+    }
+    merge();
+    if (nhist > MAXSIZES){
+        for (i = 0; i < nhist; i++)
+            hist[i].size = coarse(hist[i].size);
+        merge();
+    }
+    m = nhist;
+    if ((size_t)k > m)
+        k = (int)m;
+
+    /* prefix sums of count, bytes and squared count */
+    cnt = calloc(m + 1, sizeof(double));
+    byt = calloc(m + 1, sizeof(double));
+    sq = calloc(m + 1, sizeof(double));
+    best = malloc(m * sizeof(double));
+    cost = malloc(m * sizeof(double));
+    from = malloc((size_t)k * m * sizeof(size_t));
+    if (!cnt || !byt || !sq || !best || !cost || !from){
+        fprintf(stderr, "mm_sctool: out of memory\n");
+        return 1;
+    }
+    for (i = 0; i < m; i++){
+        cnt[i+1] = cnt[i] + hist[i].count;
+        byt[i+1] = byt[i] + hist[i].count * (double)hist[i].size;
+        sq[i+1] = sq[i] + hist[i].count * hist[i].count;
+    }
+    ctot = cnt[m];
+    btot = byt[m];
+
+/* cost of one class holding the sizes from index a to b */
+#define CLASSCOST(a, b) \
+    (((double)hist[b].size * (cnt[(b)+1] - cnt[a]) - (byt[(b)+1] - byt[a])) \
+         / btot + \
+     lambda * ((cnt[(b)+1] - cnt[a]) * (cnt[(b)+1] - cnt[a]) - \
+               (sq[(b)+1] - sq[a])) / 2 / (cnt[(b)+1] - cnt[a]) / ctot)
+
+    /* best[j]: lowest cost of covering sizes 0..j with c+1 classes,
+     * from[c*m+j]: first size index of the last of those classes */
+    for (j = 0; j < m; j++){
+        best[j] = CLASSCOST(0, j);
+        from[j] = 0;
+    }
+    for (c = 1; c < k; c++){
+        for (j = m; j-- > (size_t)c; ){
+            cost[j] = -1;
+            for (i = c; i <= j; i++){
+                double v = best[i-1] + CLASSCOST(i, j);
+                if ((cost[j] < 0) || (v < cost[j])){
+                    cost[j] = v;
+                    from[c*m + j] = i;
+                }
+            }
+        }
+        for (j = c; j < m; j++)
+            best[j] = cost[j];
+    }
+
+    /* walk back the upper size of each class, from the last one */
+    j = m - 1;
+    i = 0;
+    for (c = k - 1; c >= 0; c--){
+        upper[i++] = hist[j].size;
+        if (c > 0)
+            j = from[c*m + j] - 1;
+    }
+
+    if ((out != NULL) && ((fp = fopen(out, "w")) == NULL)){
+        perror(out);
+        return 1;
+    }
+    if (out == NULL)
+        fp = stdout;
+    fprintf(fp, "/*\n * mm_sizeclass.h\n *\n");
+    fprintf(fp, " * Size class table of the segregated lists in mm.c, "
+            "generated by\n * mm_sctool from %.0f allocations of %lu "
+            "distinct block sizes\n * (lambda %g, cost %g).\n */\n\n",
+            ctot, (unsigned long)m, lambda, best[m-1]);
+    fprintf(fp, "#ifndef MM_SIZECLASS_H\n#define MM_SIZECLASS_H\n\n");
+    fprintf(fp, "#define MM_NCLASS %lu\n", (unsigned long)i);
+    fprintf(fp, "#define MM_SCUPPER_INIT {");
+    while (i-- > 1)
+        fprintf(fp, "%lu, ", (unsigned long)upper[i]);
+    fprintf(fp, "\\\n                         0xffffffffffffffff}\n");
+    fprintf(fp, "\n#endif\n");
+    if (fp != stdout)
+        fclose(fp);
+
+    free(hist);
+    free(cnt);
+    free(byt);
+    free(sq);
+    free(best);
+    free(cost);
+    free(from);
+    return 0;
+}
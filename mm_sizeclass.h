@@ -0,0 +1,22 @@
+/*
+ * mm_sizeclass.h
+ *
+ * Size class table of the segregated lists in mm.c. MM_SCUPPER_INIT
+ * lists the upper block size (in bytes, header included) of each list
+ * in increasing order; a free block goes into the first list whose upper
+ * size is not less than its size, so the last entry must be the largest
+ * size_t value.
+ *
+ * This is the default table, nine lists increasing by multiple 2. Run
+ * mm_sctool on allocation traces to generate a table for a workload,
+ * and replace this file with its output.
+ */
+
+#ifndef MM_SIZECLASS_H
+#define MM_SIZECLASS_H
+
+#define MM_NCLASS 9
+#define MM_SCUPPER_INIT {16, 32, 64, 128, 256, 512, 1024, 2048, \
+                         0xffffffffffffffff}
+
+#endif
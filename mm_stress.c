@@ -0,0 +1,468 @@
+/*
+ * mm_stress.c
+ *
+ * Randomized differential stress test of the allocator in mm.c. Every
+ * operation is done on the heap and on glibc side by side: both blocks
+ * get the same random bytes, and a block is compared with its glibc
+ * shadow before it is freed or reallocated, so any payload overwritten
+ * by the allocator shows up. mm_checkheap runs every few operations and
+ * must return 0. Now and then the heap is saved with mm_persist and
+ * attached again with mm_attach, and every live block must come back
+ * as it was. Each seed then replays its operations without any of the
+ * checks, to measure ops/sec, and reports the heap utilization: the
+ * largest ratio of peak live payload to heap size seen between two
+ * heap resets, which happen at the start and when the heap is full.
+ *
+ * Build it with mm.c compiled with -DDRIVER, e.g.
+ *   gcc -O2 -DDRIVER -DNDEBUG -o mm_stress mm_stress.c mm.c memlib.c
+ *
+ * Usage: mm_stress [-s first seed] [-r seeds] [-n ops] [-c interval]
+ *
+ * The exit status is 1 when any seed fails. Every seed picks one of the
+ * size and order distributions below and one of the MM_CONF settings in
+ * confs, so a range of seeds covers all.
+ *
+ * The C++ front ends of mm_allocator.hpp are checked by its C++ part,
+ * mm_stress_pmr.cpp, through the standard pool resources.
+ *
+ * Built with -DMM_FUZZ it has no main, and provides the libFuzzer entry
+ * LLVMFuzzerTestOneInput instead, which reads the MM_CONF setting and
+ * the operations from the fuzzer input and aborts on the first
+ * difference, e.g.
+ *   clang -g -O1 -fsanitize=fuzzer -DDRIVER -DNDEBUG -DMM_FUZZ \
+ *         -o mm_fuzz mm_stress.c mm.c memlib.c
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "mm_ext.h"
+
+#define NSLOT 1024
+#define CACHELINE 64
+
+/* operations */
+enum { OP_MALLOC, OP_CALLOC, OP_REALLOC, OP_FREE, OP_CACHELINE,
+       OP_SIZED, OP_MAINTAIN, OP_PERSIST, NOP };
+
+/* MM_CONF settings the heap runs under */
+static const char *confs[] = {"", "defer:8", "fit:first",
+                              "fit:best,defer:64", "fit:first,defer:1"};
+#define NCONF (int)(sizeof(confs) / sizeof(confs[0]))
+
+/* size distributions */
+enum { SZ_TINY, SZ_EDGE, SZ_MIXED, SZ_GROW, NSZ };
+
+/* order distributions: which slot an operation works on */
+enum { ORD_RANDOM, ORD_LIFO, ORD_FIFO, ORD_ALTERNATE, NORD };
+
+/* one live block on both heaps */
+typedef struct {
+    char *mm;           /* block on the heap, NULL when the slot is empty */
+    char *shadow;       /* glibc copy of it */
+    size_t size;
+    int cacheline;      /* from mm_malloc_cacheline */
+    int sized;          /* from mm_malloc_class, freed by mm_free_sized */
+} slot_t;
+
+static slot_t slots[NSLOT];
+/* payload bytes have their own random stream, so the timing replay,
+ * which writes no payload, draws the same operations from rng */
+static uint64_t bytes;
+static int checking;        /* 0 in the timing replay */
+static unsigned long seedno;
+static long opno;
+static const char *conf = "";
+static size_t live, peak;
+static double util;         /* largest peak over heap size, in percent */
+static char path[64];       /* file of mm_persist */
+
+static uint64_t next(uint64_t *x){
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+static void fail(const char *what){
+    fflush(stdout);
+    fprintf(stderr, "mm_stress: seed %lu op %ld MM_CONF=%s: %s\n", seedno,
+            opno, conf, what);
+#ifdef MM_FUZZ
+    abort();
+#else
+    exit(1);
+#endif
+}
+
+/* fill both copies of the slot from byte off with the same random bytes */
+static void fill(slot_t *s, size_t off){
+    size_t i;
+    if (!checking)
+        return;
+    for (i = off; i < s->size; i++)
+        s->mm[i] = s->shadow[i] = (char)next(&bytes);
+}
+
+static void compare(slot_t *s){
+    if (checking && memcmp(s->mm, s->shadow, s->size))
+        fail("payload differs from the glibc copy");
+}
+
+/* sanity of a block the heap just returned for size bytes */
+static void check_new(char *p, size_t size, int cacheline){
+    if (!checking)
+        return;
+    if ((uintptr_t)p % (cacheline ? CACHELINE : 8))
+        fail("block is not aligned");
+    if (((void *)p < mem_heap_lo()) || ((void *)(p + size - 1) >
+                                         mem_heap_hi()))
+        fail("block is outside the heap");
+    if (!cacheline && (mm_malloc_usable_size(p) < size))
+        fail("usable size is less than the request");
+}
+
+/* glibc copy of a new block, none in the timing replay */
+static char *shadow(char *old, size_t size){
+    char *q;
+    if (!checking)
+        return NULL;
+    q = (old == NULL) ? calloc(1, size) : realloc(old, size);
+    if (q == NULL)
+        fail("glibc is out of memory");
+    return q;
+}
+
+static void release_slot(slot_t *s){
+    compare(s);
+    if (s->cacheline)
+        mm_free_cacheline(s->mm, s->size);
+    else if (s->sized)
+        mm_free_sized(s->mm, s->size);
+    else
+        mm_free(s->mm);
+    free(s->shadow);
+    live -= s->size;
+    s->mm = s->shadow = NULL;
+    s->size = 0;
+}
+
+/* do one operation on slot k, return -1 when the heap is full */
+static int do_op(int op, int k, size_t size){
+    slot_t *s = &slots[k];
+    char *p, *q;
+    size_t i;
+
+    opno++;
+    if ((op == OP_PERSIST) && checking){
+        /* the attached heap must hold every live block as it was, the
+         * file can go at once since the mapping keeps it */
+        if (path[0] == '\0')
+            snprintf(path, sizeof(path), "/tmp/mm_stress.%ld.heap",
+                     (long)getpid());
+        if (mm_persist(path) < 0)
+            fail("mm_persist failed");
+        if (mm_attach(path) < 0)
+            fail("mm_attach failed");
+        unlink(path);
+        for (i = 0; i < NSLOT; i++){
+            if (slots[i].mm != NULL)
+                compare(&slots[i]);
+        }
+        return 0;
+    }
+    /* the timing replay leaves the file out, but releases the deferred
+     * blocks as mm_persist does, so the heap stays the same */
+    if ((op == OP_MAINTAIN) || (op == OP_PERSIST) || ((op == OP_FREE) && (s->mm == NULL))){
+        mm_maintain(0);
+        return 0;
+    }
+    if (op == OP_FREE){
+        release_slot(s);
+        return 0;
+    }
+    if ((op == OP_REALLOC) && (s->mm != NULL) && !s->cacheline &&
+        !s->sized){
+        compare(s);
+        p = mm_realloc(s->mm, size);
+        if (size == 0){
+            if (p != NULL)
+                fail("realloc to 0 did not free");
+            free(s->shadow);
+            live -= s->size;
+            s->mm = s->shadow = NULL;
+            s->size = 0;
+            return 0;
+        }
+        if (p == NULL)
+            return -1;
+        q = shadow(s->shadow, size);
+        check_new(p, size, 0);
+        live = live - s->size + size;
+        s->mm = p;
+        s->shadow = q;
+        i = s->size;
+        s->size = size;
+        /* the kept part must have moved along */
+        if (i < size){
+            if (checking && memcmp(p, q, i))
+                fail("realloc lost the payload");
+            fill(s, i);
+        }
+        else
+            compare(s);
+    }
+    else{
+        if (s->mm != NULL)
+            release_slot(s);
+        if (size == 0){
+            if ((op != OP_CACHELINE) && (mm_malloc(0) != NULL))
+                fail("malloc(0) did not return NULL");
+            return 0;
+        }
+        if (op == OP_CACHELINE)
+            p = mm_malloc_cacheline(size);
+        else if (op == OP_SIZED)
+            p = mm_malloc_class(mm_block_size(size),
+                                mm_size_class(mm_block_size(size)));
+        else if (op == OP_CALLOC)
+            p = mm_calloc(1, size);
+        else
+            p = mm_malloc(size);
+        if (p == NULL)
+            return -1;
+        check_new(p, size, (op == OP_CACHELINE));
+        /* mm_free_sized works the block size out from size */
+        if ((op == OP_SIZED) && checking &&
+            (mm_malloc_usable_size(p) + 4 != mm_block_size(size)))
+            fail("mm_malloc_class block is not the exact size");
+        q = shadow(NULL, size);
+        s->mm = p;
+        s->shadow = q;
+        s->size = size;
+        s->cacheline = (op == OP_CACHELINE);
+        s->sized = (op == OP_SIZED);
+        live += size;
+        if ((op == OP_CALLOC) && checking){
+            for (i = 0; i < size; i++){
+                if (p[i])
+                    fail("calloc block is not zeroed");
+            }
+        }
+        else
+            fill(s, 0);
+    }
+    if (live > peak)
+        peak = live;
+    return 0;
+}
+
+/* fold the peak since the last reset into util */
+static void note_util(void){
+    if ((mem_heapsize() > 0) && (100.0 * peak / mem_heapsize() > util))
+        util = 100.0 * peak / mem_heapsize();
+}
+
+/* start from an empty heap under conf and no live blocks */
+static void reset(void){
+    int k;
+    note_util();
+    for (k = 0; k < NSLOT; k++){
+        free(slots[k].shadow);
+        slots[k].mm = slots[k].shadow = NULL;
+        slots[k].size = 0;
+    }
+    mem_reset_brk();
+    setenv("MM_CONF", conf, 1);
+    if (mm_init() < 0)
+        fail("mm_init failed");
+    opno = 0;
+    live = peak = 0;
+}
+
+#ifndef MM_FUZZ
+
+static const char *szname[NSZ] = {"tiny", "edge", "mixed", "grow"};
+static const char *ordname[NORD] = {"random", "lifo", "fifo", "alternate"};
+static uint64_t rng;
+
+/* request size of the given distribution */
+static size_t pick_size(int dist){
+    uint64_t r = next(&rng);
+    size_t upper;
+
+    switch (dist){
+    case SZ_TINY:
+        return r % 65;
+    case SZ_EDGE:
+        /* requests whose block lands on or next to a class boundary,
+         * a table of one class has none, so take powers of 2 then */
+#if MM_NCLASS > 1
+        upper = mm_scupper[r % (MM_NCLASS - 1)];
+#else
+        upper = (size_t)16 << (r % 9);
+#endif
+        return upper - 4 + (size_t)((r >> 16) % 17) - 8;
+    case SZ_MIXED:
+        if ((r & 15) == 0)
+            return (r >> 8) % 65536;
+        return (r >> 8) % ((r & 16) ? 1024 : 128);
+    default:
+        /* sizes grow with the operation count, then start over */
+        return (size_t)(opno % 4096) * 4 + (r % 64);
+    }
+}
+
+/*
+ * run - do ops operations of the given seed, checking every interval
+ * operations, return the seconds spent in the allocator calls' loop
+ */
+static double run(uint64_t seed, long ops, long interval){
+    int szdist = seed % NSZ, order = (seed / NSZ) % NORD;
+    int k = 0, op, burst = 0, freeing = 0;
+    struct timespec t0, t1;
+    uint64_t r;
+
+    seedno = (unsigned long)seed;
+    conf = confs[seed % NCONF];
+    rng = seed * 2654435761ULL + 1;
+    bytes = seed;
+    reset();
+    util = 0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while (opno < ops){
+        r = next(&rng);
+        if (order == ORD_RANDOM){
+            k = r % NSLOT;
+            op = (r >> 12) % 16;
+            op = (op < 5) ? OP_MALLOC : (op < 6) ? OP_SIZED :
+                 (op < 8) ? OP_CALLOC :
+                 (op < 11) ? OP_REALLOC : (op < 15) ? OP_FREE :
+                 ((r >> 20) % 8) ? OP_CACHELINE : OP_MAINTAIN;
+        }
+        else{
+            /* fill a burst of slots, then free them in the given order */
+            if (!freeing){
+                op = ((r >> 12) % 8 == 0) ? OP_CALLOC :
+                     ((r >> 12) % 8 == 1) ? OP_CACHELINE :
+                     ((r >> 12) % 8 == 2) ? OP_SIZED : OP_MALLOC;
+                k = burst++;
+                if (burst == NSLOT){
+                    freeing = 1;
+                    burst = 0;
+                }
+            }
+            else{
+                op = OP_FREE;
+                if (order == ORD_LIFO)
+                    k = NSLOT - 1 - burst;
+                else if (order == ORD_FIFO)
+                    k = burst;
+                else
+                    k = (burst < NSLOT / 2) ? 2 * burst :
+                        2 * (burst - NSLOT / 2) + 1;
+                if (++burst == NSLOT){
+                    freeing = 0;
+                    burst = 0;
+                }
+            }
+        }
+        if ((r >> 40) % 4096 == 0)
+            op = OP_PERSIST;
+        if (do_op(op, k, pick_size(szdist)) < 0){
+            /* the heap is full, start over */
+            reset();
+            continue;
+        }
+        if (checking && (interval > 0) && (opno % interval == 0) &&
+            mm_checkheap(0))
+            fail("mm_checkheap found errors");
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    note_util();
+    if (checking && mm_checkheap(0))
+        fail("mm_checkheap found errors");
+    return (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+}
+
+int main(int argc, char **argv){
+
+    uint64_t seed = 1, last;
+    long ops = 100000, interval = 1000, runs = 16;
+    double secs;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:r:n:c:")) != -1){
+        switch (opt){
+        case 's': seed = strtoull(optarg, NULL, 0); break;
+        case 'r': runs = atol(optarg); break;
+        case 'n': ops = atol(optarg); break;
+        case 'c': interval = atol(optarg); break;
+        default:
+            fprintf(stderr, "usage: %s [-s first seed] [-r seeds] [-n ops] "
+                    "[-c interval]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    mem_init();
+    printf("%-8s %-6s %-10s %-18s %10s %12s %6s\n", "seed", "sizes", "order",
+           "conf", "ops", "ops/sec", "util");
+    for (last = seed + runs; seed < last; seed++){
+        checking = 1;
+        run(seed, ops, interval);
+        /* replay it without checks to measure the allocator alone */
+        checking = 0;
+        secs = run(seed, ops, 0);
+        printf("%-8lu %-6s %-10s %-18s %10ld %12.0f %5.1f%%\n",
+               (unsigned long)seed, szname[seed % NSZ],
+               ordname[(seed / NSZ) % NORD], conf[0] ? conf : "default",
+               ops, (secs > 0) ? ops / secs : 0.0, util);
+    }
+    reset();
+    mem_deinit();
+    return 0;
+}
+
+#else
+
+/*
+ * LLVMFuzzerTestOneInput - the first byte of the input picks the
+ * MM_CONF setting, then every 5 bytes are one operation: the operation,
+ * a 16 bit slot and a 16 bit size. An operation byte of 0xff persists
+ * and attaches the heap, which is too slow for every eighth operation
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size){
+
+    static int inited = 0;
+    size_t i;
+
+    if (!inited){
+        mem_init();
+        inited = 1;
+    }
+    if (size == 0)
+        return 0;
+    checking = 1;
+    conf = confs[data[0] % NCONF];
+    bytes = 88172645463325252ULL;
+    reset();
+    for (i = 1; i + 5 <= size; i += 5){
+        if (do_op((data[i] == 0xff) ? OP_PERSIST : data[i] % OP_PERSIST,
+                  ((int)data[i+1] | ((int)data[i+2] << 8)) % NSLOT,
+                  (size_t)data[i+3] | ((size_t)data[i+4] << 8)) < 0)
+            break;
+        if (mm_checkheap(0))
+            fail("mm_checkheap found errors");
+    }
+    reset();
+    return 0;
+}
+
+#endif
@@ -0,0 +1,160 @@
+/*
+ * mm_stress_pmr.cpp
+ *
+ * The C++ part of the mm_stress harness: sends mm::heap() and
+ * mm::allocator of mm_allocator.hpp through the standard containers and
+ * pool resources, with the default max_align_t alignment and larger
+ * ones, checking the alignment and the payload of every object and
+ * that mm_checkheap returns 0, under a few MM_CONF settings.
+ *
+ * mm.c stays C, so build it apart, e.g.
+ *   gcc -c -O2 -DDRIVER -DNDEBUG mm.c memlib.c
+ *   g++ -std=c++17 -O2 -DNDEBUG -o mm_stress_pmr mm_stress_pmr.cpp \
+ *       mm.o memlib.o
+ *
+ * The exit status is 1 when a check fails.
+ */
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <memory_resource>
+#include <vector>
+
+extern "C" {
+#include "mm.h"
+#include "memlib.h"
+}
+#include "mm_allocator.hpp"
+
+namespace {
+
+const char *conf = "";
+
+void fail(const char *what) {
+    std::fprintf(stderr, "mm_stress_pmr: MM_CONF=%s: %s\n", conf, what);
+    std::exit(1);
+}
+
+void check_heap(const char *where) {
+    if (mm_checkheap(0))
+        fail(where);
+}
+
+/* one object taken from a memory_resource */
+struct object {
+    unsigned char *p;
+    std::size_t size, align;
+};
+
+void fill(const object &o) {
+    for (std::size_t i = 0; i < o.size; i++)
+        o.p[i] = static_cast<unsigned char>((o.size + i) * 31);
+}
+
+void compare(const object &o) {
+    for (std::size_t i = 0; i < o.size; i++) {
+        if (o.p[i] != static_cast<unsigned char>((o.size + i) * 31))
+            fail("payload of an object changed");
+    }
+}
+
+/* random allocations and frees of size and alignment on r, with the
+ * alignments up to the naligns first ones of aligns */
+void churn(std::pmr::memory_resource *r, int naligns, const char *name) {
+    static const std::size_t aligns[] = {1, 8, 16, 32, 64, 4096};
+    std::vector<object> live;
+    std::uint64_t x = 88172645463325252ULL;
+    int n;
+
+    for (n = 0; n < 20000; n++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        if (!live.empty() && (x % 3 == 0)) {
+            std::size_t k = (x >> 8) % live.size();
+            compare(live[k]);
+            r->deallocate(live[k].p, live[k].size, live[k].align);
+            live[k] = live.back();
+            live.pop_back();
+            continue;
+        }
+        object o;
+        o.size = 1 + (x >> 16) % ((x & 64) ? 2000 : 100);
+        o.align = aligns[(x >> 40) % naligns];
+        o.p = static_cast<unsigned char *>(r->allocate(o.size, o.align));
+        if (reinterpret_cast<std::uintptr_t>(o.p) % o.align)
+            fail(name);
+        fill(o);
+        live.push_back(o);
+    }
+    for (const object &o : live) {
+        compare(o);
+        r->deallocate(o.p, o.size, o.align);
+    }
+}
+
+void run() {
+    mem_reset_brk();
+    if (mm_init() < 0)
+        fail("mm_init failed");
+
+    /* the default alignment of allocate is alignof(max_align_t) */
+    void *p = mm::heap()->allocate(100);
+    if (reinterpret_cast<std::uintptr_t>(p) % alignof(std::max_align_t))
+        fail("heap()->allocate is not max_align_t aligned");
+    mm::heap()->deallocate(p, 100);
+
+    churn(mm::heap(), 6, "heap() object is not aligned");
+    check_heap("mm_checkheap failed after heap()");
+    {
+        /* the pool takes its chunks from heap() at max_align_t, but
+         * libstdc++ pools misalign some small objects aligned above 8
+         * even over new_delete_resource, so only ask the pool for 8 */
+        std::pmr::unsynchronized_pool_resource pool(mm::heap());
+        churn(&pool, 2, "pool object is not aligned");
+    }
+    check_heap("mm_checkheap failed after the pool resource");
+    {
+        std::pmr::monotonic_buffer_resource mono(mm::heap());
+        churn(&mono, 6, "monotonic object is not aligned");
+    }
+    check_heap("mm_checkheap failed after the monotonic resource");
+    {
+        std::pmr::vector<long double> v(mm::heap());
+        std::vector<long double, mm::allocator<long double>> w;
+        std::map<int, long double, std::less<int>,
+                 mm::allocator<std::pair<const int, long double>>> m;
+        for (int i = 0; i < 10000; i++) {
+            v.push_back(i);
+            w.push_back(i);
+            m[i] = i;
+        }
+        for (int i = 0; i < 10000; i++) {
+            if ((v[i] != i) || (w[i] != i) || (m[i] != i))
+                fail("container lost an element");
+        }
+        const std::size_t a = alignof(long double);
+        if ((reinterpret_cast<std::uintptr_t>(v.data()) % a) ||
+            (reinterpret_cast<std::uintptr_t>(w.data()) % a))
+            fail("long double array is not aligned");
+    }
+    check_heap("mm_checkheap failed after the containers");
+}
+
+} // namespace
+
+int main() {
+    static const char *confs[] = {"", "defer:8,fit:first", "fit:best"};
+
+    mem_init();
+    for (const char *c : confs) {
+        conf = c;
+        setenv("MM_CONF", c, 1);
+        run();
+    }
+    std::printf("mm_stress_pmr: ok\n");
+    return 0;
+}